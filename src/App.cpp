@@ -6,24 +6,36 @@
 #include "App.h"
 
 #include "Render/Vertex.h"
+#include "Timeline.h"
 
 #include "shaders/sky.vert.h"
 #include "shaders/sky.frag.h"
 
 #include "shaders/terrain.vert.h"
 #include "shaders/terrain.frag.h"
+#include "shaders/terrain_depth.frag.h"
+#include "shaders/terrain_tess.vert.h"
+#include "shaders/terrain.tesc.h"
+#include "shaders/terrain.tese.h"
+#include "shaders/clipmap.vert.h"
 
 #include "shaders/fog.vert.h"
 #include "shaders/fog.frag.h"
 
 #include "shaders/water.vert.h"
 #include "shaders/water.frag.h"
+#include "shaders/water_mask.frag.h"
+#include "shaders/water_composite.frag.h"
+
+#include "shaders/composite.frag.h"
 
 #include "shaders/debug.vert.h"
 #include "shaders/debug.frag.h"
 
 #include <string>
 #include <cmath>
+#include <iostream>
+#include <algorithm>
 
 const Render::InputLayout SimpleLayout = { .bindings = { {0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX} },
                                            .attributes = { {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0} }
@@ -37,26 +49,42 @@ const Render::InputLayout VertexLayout = { .bindings = { {0, sizeof(Vertex), VK_
                                                            {4, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, binormal)} }
                                          };
 
-const Render::InputLayout TerrainLayout = { .bindings = { {0, sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_VERTEX} },
-                                            .attributes = { {0, 0, VK_FORMAT_R32G32_SFLOAT, 0} }
-                                          };
-
 const Render::BindingLayout SimpleBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
                                                              {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
                                                .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 16} }
                                              };
 
-const Render::BindingLayout SkyBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
-                                                          {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
-                                            .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) } }
+const Render::BindingLayout SkyBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr} },
+                                            .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) },
+                                                            {VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float), sizeof(uint32_t) } },
+                                            .textureTable = true
                                           };
 
 const Render::BindingLayout TerrainBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
                                                               {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
                                                               {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
-                                                              {3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
-                                                              {4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
-                                               .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * (16 + 4)} }
+                                                              {5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr} },
+                                               .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * (16 + 12)},
+                                                               {VK_SHADER_STAGE_FRAGMENT_BIT, 112, sizeof(float) * 4} },
+                                               .textureTable = true
+                                              };
+
+constexpr VkShaderStageFlags TessStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+
+const Render::BindingLayout TerrainTessBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, TessStages, nullptr},
+                                                                  {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, TessStages, nullptr},
+                                                                  {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
+                                                   .pushranges = { {TessStages, 0, sizeof(float) * 8},
+                                                                   {VK_SHADER_STAGE_FRAGMENT_BIT, 112, sizeof(float) * 4} },
+                                                   .textureTable = true
+                                                  };
+
+const Render::BindingLayout ClipmapBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
+                                                              {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
+                                                              {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
+                                                .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 8},
+                                                                {VK_SHADER_STAGE_FRAGMENT_BIT, 112, sizeof(float) * 4} },
+                                                .textureTable = true
                                               };
 
 const Render::BindingLayout FogBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
@@ -64,36 +92,122 @@ const Render::BindingLayout FogBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE
                                             .pushranges = { {VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float) * 6} }
                                           };
 
-const Render::BindingLayout WaterBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},
+const Render::BindingLayout WaterBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
                                                             {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
                                                             {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
                                                             {3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
-                                                            {4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
-                                              .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) },
-                                                              {VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float), sizeof(uint32_t) * 3 },}
+                                                            {5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
+                                              .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 5 },
+                                                              {VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 5, sizeof(uint32_t) * 4 },},
+                                              .textureTable = true
                                             };
 
+const Render::BindingLayout WaterCompositeBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+                                                                     {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+                                                                     {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+                                                                     {3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+                                                                     {5, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
+                                                       .pushranges = { {VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float) * 10 } },
+                                                       .textureTable = true
+                                                     };
+
+const Render::BindingLayout WaterMaskBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr} },
+                                                  .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 5 } }
+                                                };
+
+const Render::BindingLayout CompositeBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr} },
+                                                  .pushranges = {}
+                                                };
+
 const Render::BindingLayout DebugBindings = { .bindings = { {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr} },
                                               .pushranges = { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 16} }
                                             };
 
-App::App(VkSurfaceKHR surface)
+// Permutation feature bits, bit i specializes bool constant_id i of pipeline shaders
+constexpr uint32_t ClipPlane = 1 << 0;              // Terrain vertex stages of reflection pass
+constexpr uint32_t WaterReflection = 1 << 0;        // Camera above water
+constexpr uint32_t WaterScreenSpace = 1 << 1;       // Screen-space instead of planar reflection texture
+
+// Reflection pass clips terrain slightly below water plane, so shore stays under wave troughs
+constexpr float ReflectionClipOffset = 0.8f;
+
+// Material heights of terrain.frag: dirt level, rock level, transition width, and clip height of terrain vertex stages
+const Render::Specialization TerrainConstants = Render::Specialization().set(16, 10.0f).set(17, 30.0f).set(18, 5.0f)
+                                                                        .set(22, App::WaterLevel - ReflectionClipOffset);
+
+// CDLOD reads geometry normals from atlas pages of Terrain::NormalGrid texels per tile side
+const Render::Specialization CdlodConstants = Render::Specialization(TerrainConstants).set(19, VkBool32(VK_TRUE))
+                                                                                     .set(23, int32_t(Terrain::NormalGrid));
+
+const Render::Specialization ClipmapConstants = Render::Specialization(TerrainConstants).set(20, int32_t(Clipmap::GridSize))
+                                                                                        .set(21, int32_t(Clipmap::TextureSize));
+
+App::App(VkSurfaceKHR surface, NormalFormat normalFormat)
 : m_swapchain(surface)
 , m_skyPipeline(g_sky_vert, g_sky_vert_size, g_sky_frag, g_sky_frag_size, SimpleLayout, SkyBindings, 
                 { .depthTest = VK_FALSE,
                   .depthWrite = VK_FALSE,
                   .blend = VK_TRUE,
                   .dynamicCullMode = true })
-, m_terrainPipeline(g_terrain_vert, g_terrain_vert_size, g_terrain_frag, g_terrain_frag_size, TerrainLayout, TerrainBindings, 
-                    { .dynamicCullMode = true })
+, m_skyLatePipeline(g_sky_vert, g_sky_vert_size, g_sky_frag, g_sky_frag_size, SimpleLayout, SkyBindings, 
+                    { .depthTest = VK_TRUE,
+                      .depthWrite = VK_FALSE,
+                      .blend = VK_TRUE,
+                      .dynamicCullMode = true,
+                      .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL })
+, m_terrainPipeline(g_terrain_vert, g_terrain_vert_size, g_terrain_frag, g_terrain_frag_size, {}, TerrainBindings, 
+                    { .dynamicCullMode = true,
+                      .constants = CdlodConstants,
+                      .permutations = { 0, ClipPlane } })
+, m_terrainDepthPipeline(g_terrain_vert, g_terrain_vert_size, g_terrain_depth_frag, g_terrain_depth_frag_size, {}, TerrainBindings, 
+                         { .dynamicCullMode = true,
+                           .colorWriteMask = 0 })
+, m_terrainEqualPipeline(g_terrain_vert, g_terrain_vert_size, g_terrain_frag, g_terrain_frag_size, {}, TerrainBindings, 
+                         { .depthWrite = VK_FALSE,
+                           .dynamicCullMode = true,
+                           .depthCompareOp = VK_COMPARE_OP_EQUAL,
+                           .constants = CdlodConstants })
+, m_terrainTessPipeline(g_terrain_tess_vert, g_terrain_tess_vert_size, g_terrain_tesc, g_terrain_tesc_size, g_terrain_tese, g_terrain_tese_size,
+                        g_terrain_frag, g_terrain_frag_size, {}, TerrainTessBindings, 
+                        { .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST,
+                          .dynamicCullMode = true,
+                          .patchControlPoints = 4,
+                          .constants = TerrainConstants,
+                          .permutations = { 0, ClipPlane } })
+, m_clipmapPipeline(g_clipmap_vert, g_clipmap_vert_size, g_terrain_frag, g_terrain_frag_size, {}, ClipmapBindings,
+                    { .dynamicCullMode = true,
+                      .constants = ClipmapConstants,
+                      .permutations = { 0, ClipPlane } })
 , m_fogPipeline(g_fog_vert, g_fog_vert_size, g_fog_frag, g_fog_frag_size, {}, FogBindings,
                 { .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
                   .depthTest = VK_FALSE,
                   .depthWrite = VK_FALSE,
-                  .blend = VK_TRUE })
+                  .blend = VK_TRUE,
+                  .stencilTest = VK_TRUE,
+                  .stencilCompareOp = VK_COMPARE_OP_EQUAL,
+                  .stencilReference = 1,
+                  .dynamicStencilTest = true })
 , m_waterPipeline(g_water_vert, g_water_vert_size, g_water_frag, g_water_frag_size, {}, WaterBindings, 
                   { .cullMode = VK_CULL_MODE_NONE,
-                    .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP })
+                    .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                    .permutations = { WaterReflection, 0, WaterReflection | WaterScreenSpace } })
+, m_waterMaskPipeline(g_water_vert, g_water_vert_size, g_water_mask_frag, g_water_mask_frag_size, {}, WaterMaskBindings, 
+                      { .cullMode = VK_CULL_MODE_NONE,
+                        .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                        .depthWrite = VK_FALSE,
+                        .stencilTest = VK_TRUE,
+                        .stencilPassOp = VK_STENCIL_OP_REPLACE,
+                        .stencilReference = 1,
+                        .colorWriteMask = 0 })
+, m_compositePipeline(g_fog_vert, g_fog_vert_size, g_composite_frag, g_composite_frag_size, {}, CompositeBindings,
+                      { .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                        .depthTest = VK_FALSE,
+                        .depthWrite = VK_FALSE })
+, m_waterCompositePipeline(g_fog_vert, g_fog_vert_size, g_water_composite_frag, g_water_composite_frag_size, {}, WaterCompositeBindings,
+                           { .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                             .depthTest = VK_FALSE,
+                             .depthWrite = VK_FALSE,
+                             .permutations = { WaterReflection, 0, WaterReflection | WaterScreenSpace } })
 , m_debugPipeline(g_debug_vert, g_debug_vert_size, g_debug_frag, g_debug_frag_size, SimpleLayout, DebugBindings, 
                   { .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
                     .depthTest = VK_TRUE,
@@ -102,29 +216,59 @@ App::App(VkSurfaceKHR surface)
 , m_skyReflDescriptors(m_skyPipeline.descriptorLayout())
 , m_terrainDescriptors(m_terrainPipeline.descriptorLayout())
 , m_terrainReflDescriptors(m_terrainPipeline.descriptorLayout())
+, m_terrainTessDescriptors(m_terrainTessPipeline.descriptorLayout())
+, m_terrainTessReflDescriptors(m_terrainTessPipeline.descriptorLayout())
+, m_clipmapDescriptors(m_clipmapPipeline.descriptorLayout())
+, m_clipmapReflDescriptors(m_clipmapPipeline.descriptorLayout())
 , m_fogDescriptors(m_fogPipeline.descriptorLayout())
+, m_waterDescriptors(m_waterPipeline.descriptorLayout())
+, m_waterCompositeDescriptors(m_waterCompositePipeline.descriptorLayout())
+, m_waterMaskDescriptors(m_waterMaskPipeline.descriptorLayout())
+, m_compositeDescriptors(m_compositePipeline.descriptorLayout())
 , m_debugDescriptors(m_debugPipeline.descriptorLayout())
-, m_grass(LoadImage("textures/grass.png"))
-, m_dirt(LoadImage("textures/dirt.png"))
-, m_rock(LoadImage("textures/rock.png"))
-, m_grassNorm(LoadImage("textures/grass1_n.png"))
-, m_dirtNorm(LoadImage("textures/dirt_n.png"))
-, m_rockNorm(LoadImage("textures/rock_n.png"))
-, m_clouds(LoadImage("textures/clouds.png"))
+, m_grass(m_textureBatch.add("textures/grass.png", VK_FORMAT_BC1_RGB_UNORM_BLOCK))
+, m_dirt(m_textureBatch.add("textures/dirt.png", VK_FORMAT_BC1_RGB_UNORM_BLOCK))
+, m_rock(m_textureBatch.add("textures/rock.png", VK_FORMAT_BC1_RGB_UNORM_BLOCK))
+, m_grassNorm(m_textureBatch.add("textures/grass1_n.png", VK_FORMAT_BC5_UNORM_BLOCK))
+, m_dirtNorm(m_textureBatch.add("textures/dirt_n.png", VK_FORMAT_BC5_UNORM_BLOCK))
+, m_rockNorm(m_textureBatch.add("textures/rock_n.png", VK_FORMAT_BC5_UNORM_BLOCK))
+, m_clouds(m_textureBatch.add("textures/clouds.png"))
+, m_placeholderColor(CreateSolidTexture(128, 128, 128, 255))
+, m_placeholderNormal(CreateSolidTexture(128, 128, 255, 255))
+, m_placeholderSky(CreateSolidTexture(61, 92, 153, 255))
 , m_clampSampler(VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE)
 , m_depth(VK_FORMAT_D24_UNORM_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
-, m_background(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+, m_sceneColor(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
 , m_reflection(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
 , m_reflDepth(VK_FORMAT_D24_UNORM_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
 , m_skydome(24, 16, 10.0f, 25.0f)
-, m_terrain()
+, m_terrain(normalFormat)
+, m_clipmap(m_terrain)
 , m_mainView(m_terrain)
 , m_reflectionView(m_terrain)
 , m_camera(m_mainView.camera())
 , m_reflectionThread(&App::reflectionThread, this)
+, m_terrainMode(TerrainMode::Sorted)
+, m_waterShading(WaterShading::Separate)
+, m_reflectionMode(ReflectionMode::Planar)
+, m_reflectionUpdate(ReflectionUpdate::Interval)
+, m_reflValid(false)
+, m_reflHalf(ReflectionFull)
+, m_reflFrames(0)
+, m_timestamps(VK_QUERY_TYPE_TIMESTAMP, ts_count)
+, m_statistics(VK_QUERY_TYPE_PIPELINE_STATISTICS, stat_count, VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                                                                VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                                                                VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+                                                                VK_QUERY_PIPELINE_STATISTIC_TESSELLATION_EVALUATION_SHADER_INVOCATIONS_BIT)
+, m_frameQueries(false)
+, m_reflQueries(false)
+, m_reflCpuTime(0.0)
 , m_debugDraw(false)
 , m_wireframe(false)
 , m_drawWater(true)
+, m_lateSky(true)
+, m_frameCount(0)
+, m_waterSkipCount(0)
 , m_speed(15.0f)
 , m_animTime(0.0f)
 , m_waveAnimFrame(0.0f)
@@ -134,7 +278,7 @@ App::App(VkSurfaceKHR surface)
     for (size_t i = 0; i < WavesFrameNum; i++)
     {
         std::string path = std::string("textures/waves") + std::to_string(i) + ".png";
-        m_waves[i].reset(LoadImage(path.c_str()));
+        m_waves[i].reset(m_textureBatch.add(path.c_str()));
     }
 
     initBoxGeometry();
@@ -142,7 +286,7 @@ App::App(VkSurfaceKHR surface)
     const VkExtent2D& frameExtent = m_swapchain.frameExtent();
 
     m_depth.reset(frameExtent.width, frameExtent.height);
-    m_background.reset(frameExtent.width, frameExtent.height);
+    m_sceneColor.reset(frameExtent.width, frameExtent.height);
     m_reflection.reset(frameExtent.width, frameExtent.height);
     m_reflDepth.reset(frameExtent.width, frameExtent.height);
 
@@ -153,49 +297,23 @@ App::App(VkSurfaceKHR surface)
     m_reflFramebuffer.addDepthAttachment(m_reflDepth);
     m_reflFramebuffer.setClearColor(BgColor.r, BgColor.g, BgColor.b);
 
-    m_skyDescriptors.bind(0, m_mainView.skyConstantBuffer(), sizeof(ViewConstantBuffer));
-    m_skyDescriptors.bind(1, *m_clouds, m_sampler);
+    // Texture slots are fixed for the run, streaming only rewrites what they point to
+    Render::TextureTable& textureTable = Render::VulkanInstance::GetInstance().textureTable();
 
-    m_skyReflDescriptors.bind(0, m_reflectionView.skyConstantBuffer(), sizeof(ViewConstantBuffer));
-    m_skyReflDescriptors.bind(1, *m_clouds, m_sampler);
+    for (uint32_t& slot : m_materialSlots) slot = textureTable.allocate();
 
-    m_terrainDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
-    m_terrainDescriptors.bind(1, m_terrain.heightmap(), m_clampSampler);
-    m_terrainDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
-    m_terrainDescriptors.bind(3, 0, *m_grass, m_sampler);
-    m_terrainDescriptors.bind(3, 1, *m_dirt, m_sampler);
-    m_terrainDescriptors.bind(3, 2, *m_rock, m_sampler);
-    m_terrainDescriptors.bind(4, 0, *m_grassNorm, m_sampler);
-    m_terrainDescriptors.bind(4, 1, *m_dirtNorm, m_sampler);
-    m_terrainDescriptors.bind(4, 2, *m_rockNorm, m_sampler);
+    m_cloudsSlot = textureTable.allocate();
+    m_waveSlots.resize(WavesFrameNum);
 
-    m_terrainReflDescriptors.bind(0, m_reflectionView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
-    m_terrainReflDescriptors.bind(1, m_terrain.heightmap(), m_clampSampler);
-    m_terrainReflDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
-    m_terrainReflDescriptors.bind(3, 0, *m_grass, m_sampler);
-    m_terrainReflDescriptors.bind(3, 1, *m_dirt, m_sampler);
-    m_terrainReflDescriptors.bind(3, 2, *m_rock, m_sampler);
-    m_terrainReflDescriptors.bind(4, 0, *m_grassNorm, m_sampler);
-    m_terrainReflDescriptors.bind(4, 1, *m_dirtNorm, m_sampler);
-    m_terrainReflDescriptors.bind(4, 2, *m_rockNorm, m_sampler);
+    for (uint32_t& slot : m_waveSlots) slot = textureTable.allocate();
 
-    m_fogDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
-    m_fogDescriptors.bind(1, m_depth, m_clampSampler);
+    m_terrain.setMaterials(m_materialSlots[0] | m_materialSlots[1] << 10 | m_materialSlots[2] << 20,
+                           m_materialSlots[3] | m_materialSlots[4] << 10 | m_materialSlots[5] << 20);
 
-    m_waterDescriptors.reserve(WavesFrameNum);
+    bindTextures();
+    bindDescriptors();
 
-    for (size_t i = 0; i < WavesFrameNum; i++)
-    {
-        m_waterDescriptors.emplace_back(m_waterPipeline.descriptorLayout());
-
-        m_waterDescriptors[i].bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
-        m_waterDescriptors[i].bind(1, m_depth, m_clampSampler);
-        m_waterDescriptors[i].bind(2, m_background, m_clampSampler);
-        m_waterDescriptors[i].bind(3, m_reflection, m_clampSampler);
-        m_waterDescriptors[i].bind(4, *m_waves[i], m_sampler);
-    }
-
-    m_debugDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_waterConstantBuffer->skyColor = glm::vec4(BgColor, 1.0f);
 
     resize(frameExtent.width, frameExtent.height);
     m_mainView.setProjectionMat(m_projMat, ZNear, ZFar);
@@ -203,15 +321,106 @@ App::App(VkSurfaceKHR surface)
 
     m_camera.setPos(glm::vec3(0.0f, 50.0f, 0.0f));
 
+    // Pipelines compiled on their own threads since construction, first frame binds them
+    {
+        StartupPhase phase("pipeline wait");
+
+        for (Render::Pipeline* pipeline : { &m_skyPipeline, &m_skyLatePipeline, &m_terrainPipeline, &m_terrainDepthPipeline,
+                                            &m_terrainEqualPipeline, &m_terrainTessPipeline, &m_clipmapPipeline, &m_fogPipeline,
+                                            &m_waterPipeline, &m_waterMaskPipeline, &m_compositePipeline, &m_waterCompositePipeline,
+                                            &m_debugPipeline })
+            pipeline->wait();
+    }
+
     m_reflectionThread.detach();
 }
 
 App::~App()
 {
+    std::cout << "Water skipped in " << m_waterSkipCount << " of " << m_frameCount << " frames" << std::endl;
+
     m_terminate = true;
     m_reflStartEvent.signal();
 }
 
+void App::bindDescriptors()
+{
+    m_skyDescriptors.bind(0, m_mainView.skyConstantBuffer(), sizeof(ViewConstantBuffer));
+
+    m_skyReflDescriptors.bind(0, m_reflectionView.skyConstantBuffer(), sizeof(ViewConstantBuffer));
+
+    m_terrainDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_terrainDescriptors.bind(1, m_terrain.virtualHeightmap().pageTable(), m_clampSampler);
+    m_terrainDescriptors.bind(2, m_terrain.virtualHeightmap().normalAtlas(), m_clampSampler);
+    m_terrainDescriptors.bind(5, m_terrain.virtualHeightmap().atlas(), m_clampSampler);
+
+    m_terrainReflDescriptors.bind(0, m_reflectionView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_terrainReflDescriptors.bind(1, m_terrain.virtualHeightmap().pageTable(), m_clampSampler);
+    m_terrainReflDescriptors.bind(2, m_terrain.virtualHeightmap().normalAtlas(), m_clampSampler);
+    m_terrainReflDescriptors.bind(5, m_terrain.virtualHeightmap().atlas(), m_clampSampler);
+
+    // Tessellation and clipmap sets are bound once their terrain textures are uploaded, see display
+    if (m_terrain.texturesResident())
+    {
+        m_terrainTessDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+        m_terrainTessDescriptors.bind(1, m_terrain.heightmap(), m_clampSampler);
+        m_terrainTessDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
+
+        m_terrainTessReflDescriptors.bind(0, m_reflectionView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+        m_terrainTessReflDescriptors.bind(1, m_terrain.heightmap(), m_clampSampler);
+        m_terrainTessReflDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
+
+        m_clipmapDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+        m_clipmapDescriptors.bind(1, m_clipmap.texture(), m_clampSampler);
+        m_clipmapDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
+
+        m_clipmapReflDescriptors.bind(0, m_reflectionView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+        m_clipmapReflDescriptors.bind(1, m_clipmap.texture(), m_clampSampler);
+        m_clipmapReflDescriptors.bind(2, m_terrain.normals(), m_clampSampler);
+    }
+
+    m_fogDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_fogDescriptors.bind(1, m_depth, m_clampSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+    m_waterMaskDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+
+    m_compositeDescriptors.bind(0, m_sceneColor, m_clampSampler);
+
+    m_waterDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_waterDescriptors.bind(1, m_depth, m_clampSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    m_waterDescriptors.bind(2, m_sceneColor, m_clampSampler);
+    m_waterDescriptors.bind(3, m_reflection, m_clampSampler);
+    m_waterDescriptors.bind(5, m_waterConstantBuffer, sizeof(WaterConstantBuffer));
+
+    m_waterCompositeDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+    m_waterCompositeDescriptors.bind(1, m_depth, m_clampSampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    m_waterCompositeDescriptors.bind(2, m_sceneColor, m_clampSampler);
+    m_waterCompositeDescriptors.bind(3, m_reflection, m_clampSampler);
+    m_waterCompositeDescriptors.bind(5, m_waterConstantBuffer, sizeof(WaterConstantBuffer));
+
+    m_debugDescriptors.bind(0, m_mainView.sceneConstantBuffer(), sizeof(ViewConstantBuffer));
+}
+
+// Placeholders stand in for textures until texture batch is uploaded, slots stay the same
+void App::bindTextures()
+{
+    Render::TextureTable& textureTable = Render::VulkanInstance::GetInstance().textureTable();
+
+    const Image* materials[] = { m_grass.get(), m_dirt.get(), m_rock.get(), m_grassNorm.get(), m_dirtNorm.get(), m_rockNorm.get() };
+
+    for (size_t i = 0; i < 6; i++)
+    {
+        const Image& placeholder = i < 3 ? *m_placeholderColor : *m_placeholderNormal;
+
+        textureTable.update(m_materialSlots[i], m_texturesLoaded ? *materials[i] : placeholder, m_sampler);
+    }
+
+    textureTable.update(m_cloudsSlot, m_texturesLoaded ? *m_clouds : *m_placeholderSky, m_sampler);
+
+    for (size_t i = 0; i < WavesFrameNum; i++)
+        textureTable.update(m_waveSlots[i], m_texturesLoaded ? *m_waves[i] : *m_placeholderNormal, m_sampler);
+}
+
 void App::initBoxGeometry()
 {
     std::vector<glm::vec3> vertices = { {-1.0f, 1.0f, -1.0f},  {-1.0f, 1.0f, 1.0f},  {1.0f, 1.0f, 1.0f},  {1.0f, 1.0f, -1.0f},
@@ -256,6 +465,17 @@ void App::input(const SDL_Event& event)
             if (event.key.key == SDLK_1) m_debugDraw = !m_debugDraw;
             if (event.key.key == SDLK_2) m_wireframe = !m_wireframe;
             if (event.key.key == SDLK_3) m_drawWater = !m_drawWater;
+            if (event.key.key == SDLK_4) switchReflectionUpdate();
+            if (event.key.key == SDLK_5) switchReflectionMode();
+            if (event.key.key == SDLK_6) switchWaterShading();
+            if (event.key.key == SDLK_7) switchSkyOrder();
+            if (event.key.key == SDLK_8) switchTerrainMode();
+            if (event.key.key == SDLK_9) switchIndexOrder();
+            if (event.key.key == SDLK_0) switchTileGrid();
+            if (event.key.key == SDLK_T) switchTerrainLod();
+            if (event.key.key == SDLK_B) startReflectionBenchmark();
+            if (event.key.key == SDLK_N) startWaterBenchmark();
+            if (event.key.key == SDLK_M) startTerrainBenchmark();
         break;
     }
 }
@@ -269,14 +489,287 @@ void App::update(float dt)
 
     m_animTime = std::fmod(m_animTime + dt * AnimSpeed, AnimRange);
     m_waveAnimFrame = std::fmod(m_waveAnimFrame + dt * 8.0f, float(WavesFrameNum));
+
+    updateStreaming();
+}
+
+// Swaps in streamed resources between frames, reflection thread is idle and GPU is drained first
+void App::updateStreaming()
+{
+    bool rebind = false;
+
+    if (!m_texturesLoaded && m_textureBatch.ready())
+    {
+        Render::VulkanInstance::GetInstance().waitIdle();
+
+        m_textureBatch.upload();
+        m_texturesLoaded = true;
+        bindTextures();
+    }
+
+    if (m_terrain.update())
+    {
+        m_clipmap.invalidate();
+        m_reflValid = false;
+        rebind = true;
+    }
+
+    if (rebind) bindDescriptors();
+
+    if (m_startupReported || !m_texturesLoaded || m_terrain.streaming()) return;
+
+    static const char* normalFormats[] = { "RGBA8", "octahedral RG8", "octahedral RG16", "derived from heightmap" };
+
+    std::cout << "Terrain normals: " << normalFormats[int(m_terrain.normalFormat())] << ", " 
+              << m_terrain.normalBytes() * 1e-6 << " MB" << std::endl;
+
+    size_t materialBytes = 0;
+
+    for (Image* image : { m_grass.get(), m_dirt.get(), m_rock.get(), m_grassNorm.get(), m_dirtNorm.get(), m_rockNorm.get() })
+        materialBytes += image->size();
+
+    std::cout << "Material textures: " << materialBytes * 1e-6 << " MB" << std::endl;
+
+    StartupTimeline::GetInstance().report();
+    m_startupReported = true;
+}
+
+void App::switchReflectionMode()
+{
+    m_reflectionMode = m_reflectionMode == ReflectionMode::Planar ? ReflectionMode::ScreenSpace : ReflectionMode::Planar;
+    m_reflValid = false;
+
+    std::cout << "Reflection mode: " << (m_reflectionMode == ReflectionMode::Planar ? "planar" : "screen-space") << std::endl;
+}
+
+void App::startReflectionBenchmark()
+{
+    auto reflectionSetup = [this](ReflectionMode mode, ReflectionUpdate update)
+    {
+        return [this, mode, update]()
+        {
+            m_reflectionMode = mode;
+            m_reflectionUpdate = update;
+            m_reflValid = false;
+        };
+    };
+
+    m_profiler.start({ { "planar, every frame", reflectionSetup(ReflectionMode::Planar, ReflectionUpdate::EveryFrame) },
+                       { "planar, interval", reflectionSetup(ReflectionMode::Planar, ReflectionUpdate::Interval) },
+                       { "screen-space", reflectionSetup(ReflectionMode::ScreenSpace, ReflectionUpdate::EveryFrame) } });
+}
+
+void App::collectStats()
+{
+    Render::VulkanInstance& vkInstance = Render::VulkanInstance::GetInstance();
+
+    double period = vkInstance.timestampPeriod() * 1e-6;    // ms
+    uint64_t timestamps[2];
+
+    if (m_frameQueries)
+    {
+        m_timestamps.results(ts_frame_begin, 2, timestamps);
+        m_profiler.add("GPU main (ms)", (timestamps[1] - timestamps[0]) * period);
+
+        m_timestamps.results(ts_terrain_begin, 2, timestamps);
+        m_profiler.add("GPU terrain (ms)", (timestamps[1] - timestamps[0]) * period);
+
+        uint64_t statistics[stat_count][stat_value_count];
+
+        m_statistics.results(0, stat_count, statistics[0]);
+        m_profiler.add("sky fragments (K)", statistics[stat_sky][stat_fs_invocations] * 1e-3);
+
+        const uint64_t* terrain = statistics[stat_terrain];
+
+        // Vertices not shaded again were taken from post-transform cache
+        m_profiler.add("terrain VS invocations (K)", terrain[stat_vs_invocations] * 1e-3);
+        m_profiler.add("terrain TES invocations (K)", terrain[stat_tes_invocations] * 1e-3);
+        m_profiler.add("terrain vertex cache hits (%)", terrain[stat_ia_vertices] ? 
+                                                        100.0 * (1.0 - double(terrain[stat_vs_invocations]) / terrain[stat_ia_vertices]) : 0.0);
+        m_profiler.add("terrain normal fetch (MB)", terrain[stat_fs_invocations] * m_terrain.normalFetchBytes() * 1e-6);
+        m_profiler.add("terrain normal texture (MB)", m_terrain.normalBytes() * 1e-6);
+    }
+
+    if (m_reflQueries)
+    {
+        m_timestamps.results(ts_refl_begin, 2, timestamps);
+        m_profiler.add("GPU reflection (ms)", (timestamps[1] - timestamps[0]) * period);
+        m_profiler.add("CPU reflection (ms)", m_reflCpuTime);
+    }
+
+    m_profiler.nextFrame();
+}
+
+void App::switchWaterShading()
+{
+    m_waterShading = m_waterShading == WaterShading::Separate ? WaterShading::Combined : WaterShading::Separate;
+
+    std::cout << "Water shading: " << (m_waterShading == WaterShading::Separate ? "separate passes" : "combined pass") << std::endl;
+}
+
+void App::startWaterBenchmark()
+{
+    auto shadingSetup = [this](WaterShading shading)
+    {
+        return [this, shading]() { m_waterShading = shading; };
+    };
+
+    m_profiler.start({ { "separate passes", shadingSetup(WaterShading::Separate) },
+                       { "combined pass", shadingSetup(WaterShading::Combined) } });
+}
+
+void App::setTerrainMode(TerrainMode mode)
+{
+    m_terrainMode = mode;
+
+    m_mainView.setSortTiles(mode != TerrainMode::Unsorted);
+    m_reflectionView.setSortTiles(mode != TerrainMode::Unsorted);
+}
+
+void App::switchTerrainMode()
+{
+    static const char* modeNames[] = { "unsorted", "front to back", "depth prepass" };
+
+    setTerrainMode(TerrainMode((int(m_terrainMode) + 1) % 3));
+
+    std::cout << "Terrain mode: " << modeNames[int(m_terrainMode)] << std::endl;
+}
+
+void App::switchIndexOrder()
+{
+    bool morton = m_terrain.indexOrder() == TileIndexOrder::Morton;
+
+    m_terrain.setIndexOrder(morton ? TileIndexOrder::Linear : TileIndexOrder::Morton);
+
+    std::cout << "Tile index order: " << (morton ? "linear" : "morton") << std::endl;
+}
+
+void App::switchTileGrid()
+{
+    m_terrain.setAdaptiveGrid(!m_terrain.adaptiveGrid());
+
+    std::cout << "Tile grid: " << (m_terrain.adaptiveGrid() ? "adaptive" : "fixed") << std::endl;
+}
+
+void App::switchTerrainLod()
+{
+    static const char* lodNames[] = { "CDLOD", "tessellation", "clipmap" };
+
+    m_terrain.setLod(TerrainLod((int(m_terrain.lod()) + 1) % 3));
+
+    std::cout << "Terrain LOD: " << lodNames[int(m_terrain.lod())] << std::endl;
+}
+
+void App::startTerrainBenchmark()
+{
+    auto terrainSetup = [this](TerrainMode mode, TileIndexOrder order, bool adaptive = true, TerrainLod lod = TerrainLod::CDLOD)
+    {
+        return [this, mode, order, adaptive, lod]() 
+        { 
+            setTerrainMode(mode); 
+            m_terrain.setIndexOrder(order);
+            m_terrain.setAdaptiveGrid(adaptive);
+            m_terrain.setLod(lod);
+        };
+    };
+
+    m_profiler.start({ { "unsorted", terrainSetup(TerrainMode::Unsorted, TileIndexOrder::Morton) },
+                       { "front to back", terrainSetup(TerrainMode::Sorted, TileIndexOrder::Morton) },
+                       { "depth prepass", terrainSetup(TerrainMode::DepthPrepass, TileIndexOrder::Morton) },
+                       { "front to back, linear indices", terrainSetup(TerrainMode::Sorted, TileIndexOrder::Linear) },
+                       { "front to back, fixed grid", terrainSetup(TerrainMode::Sorted, TileIndexOrder::Morton, false) },
+                       { "tessellation", terrainSetup(TerrainMode::Sorted, TileIndexOrder::Morton, true, TerrainLod::Tessellation) },
+                       { "clipmap", terrainSetup(TerrainMode::Sorted, TileIndexOrder::Morton, true, TerrainLod::Clipmap) } });
+}
+
+void App::switchSkyOrder()
+{
+    m_lateSky = !m_lateSky;
+
+    std::cout << "Sky: " << (m_lateSky ? "after terrain" : "before terrain") << std::endl;
+}
+
+void App::displaySky(Render::CommandList& commandList, const Render::DescriptorSet& descriptors, bool late)
+{
+    commandList.bindPipeline(late ? m_skyLatePipeline : m_skyPipeline);
+    commandList.bindDescriptorSet(descriptors);
+
+    commandList.setConstant(0, m_animTime);
+    commandList.setConstant(4, m_cloudsSlot, VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_skydome.display(commandList);
+}
+
+void App::switchReflectionUpdate()
+{
+    static const char* modeNames[] = { "every frame", "interval", "halves" };
+
+    m_reflectionUpdate = ReflectionUpdate((int(m_reflectionUpdate) + 1) % 3);
+    m_reflValid = false;
+
+    std::cout << "Reflection update: " << modeNames[int(m_reflectionUpdate)] << std::endl;
+}
+
+bool App::updateReflectionState()
+{
+    glm::vec2 angles = { m_camera.verticalAngle(), m_camera.horyzontalAngle() };
+    glm::vec2 rotation = glm::abs(angles - m_reflCameraAngles);
+    rotation.y = std::min(rotation.y, 360.0f - rotation.y);
+
+    float drift = glm::length(m_camera.pos() - m_reflCameraPos) + (rotation.x + rotation.y) * ReflectionAngleWeight;
+
+    m_reflFrames++;
+
+    bool refresh = !m_reflValid ||
+                   m_reflectionUpdate == ReflectionUpdate::EveryFrame ||
+                   m_reflFrames >= ReflectionMaxInterval ||
+                   drift > ReflectionMaxDrift;
+
+    if (!refresh) return false;
+
+    if (m_reflectionUpdate == ReflectionUpdate::Halves && m_reflValid)
+        m_reflHalf = m_reflHalf == ReflectionLeft ? ReflectionRight : ReflectionLeft;
+    else
+        m_reflHalf = ReflectionFull;
+
+    // Matrices used by water shader to reproject reflection between refreshes
+    const glm::mat4& viewProj = m_reflectionView.viewProj();
+
+    if (m_reflHalf != ReflectionRight) m_waterConstantBuffer->reflViewProj[0] = viewProj;
+    if (m_reflHalf != ReflectionLeft) m_waterConstantBuffer->reflViewProj[1] = viewProj;
+
+    m_reflCameraPos = m_camera.pos();
+    m_reflCameraAngles = angles;
+    m_reflFrames = 0;
+    m_reflValid = true;
+
+    return true;
 }
 
 void App::displayReflection()
 {
+    CpuTimer timer;
+
     m_reflectionView.updateVisibility();
 
+    VkRect2D renderArea = { {0, 0}, {m_width, m_height} };
+
+    if (m_reflHalf != ReflectionFull)
+    {
+        renderArea.extent.width = m_width / 2;
+
+        if (m_reflHalf == ReflectionRight)
+        {
+            renderArea.offset.x = m_width / 2;
+            renderArea.extent.width = m_width - m_width / 2;
+        }
+    }
+
+    m_reflFramebuffer.setRenderArea(renderArea);
+
     Render::VulkanInstance& vkInstance = Render::VulkanInstance::GetInstance();
     m_reflCommandList.begin();
+    m_reflCommandList.resetQueries(m_timestamps, ts_refl_begin, 2);
+    m_reflCommandList.writeTimestamp(m_timestamps, ts_refl_begin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
     // Explicit layout transition here due to thread concurency
     m_reflCommandList.barrier(m_reflection, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
@@ -284,25 +777,46 @@ void App::displayReflection()
     m_reflCommandList.bindFrameBuffer(m_reflFramebuffer);
 
     m_reflCommandList.setViewport(m_width, m_height);
+    m_reflCommandList.setScissor(renderArea.offset.x, renderArea.offset.y, renderArea.extent.width, renderArea.extent.height);
     m_reflCommandList.setPolygonMode(VK_POLYGON_MODE_FILL);
     m_reflCommandList.setCullMode(VK_CULL_MODE_FRONT_BIT);
 
-    // Sky
-    m_reflCommandList.bindPipeline(m_skyPipeline);
-    m_reflCommandList.bindDescriptorSet(m_skyReflDescriptors);
+    bool lateSky = m_lateSky;
 
-    m_reflCommandList.setConstant(0, m_animTime);
-    m_skydome.display(m_reflCommandList);
+    // Sky
+    if (!lateSky) displaySky(m_reflCommandList, m_skyReflDescriptors, false);
 
     // Terrain
-    m_reflCommandList.bindPipeline(m_terrainPipeline);
-    m_reflCommandList.bindDescriptorSet(m_terrainReflDescriptors);
-    m_reflCommandList.setConstant(8, VkBool32(VK_TRUE));
+    if (m_terrain.lod() == TerrainLod::Clipmap)
+    {
+        m_reflCommandList.bindPipeline(m_clipmapPipeline, ClipPlane);
+        m_reflCommandList.bindDescriptorSet(m_clipmapReflDescriptors);
 
-    m_reflectionView.displayTerrain(m_reflCommandList);
+        m_clipmap.display(m_reflCommandList);
+    }
+    else if (m_terrain.lod() == TerrainLod::Tessellation)
+    {
+        m_reflCommandList.bindPipeline(m_terrainTessPipeline, ClipPlane);
+        m_reflCommandList.bindDescriptorSet(m_terrainTessReflDescriptors);
+
+        m_reflectionView.displayTerrainPatches(m_reflCommandList, m_height);
+    }
+    else
+    {
+        m_reflCommandList.bindPipeline(m_terrainPipeline, ClipPlane);
+        m_reflCommandList.bindDescriptorSet(m_terrainReflDescriptors);
+
+        m_reflectionView.displayTerrain(m_reflCommandList);
+    }
+
+    if (lateSky) displaySky(m_reflCommandList, m_skyReflDescriptors, true);
 
     m_reflCommandList.finishRender();
+    m_reflCommandList.writeTimestamp(m_timestamps, ts_refl_end);
     m_reflCommandList.finish();
+
+    m_reflCpuTime = timer.elapsed();
+
     vkInstance.submit(m_reflCommandList);
 }
 
@@ -325,79 +839,247 @@ void App::display()
 
     uint32_t bufferIndex = m_swapchain.acquireBuffer();
 
+    collectStats();
+
+    // Switching away from CDLOD, possibly by profiler setup above, needs full resolution terrain textures
+    if (m_terrain.lod() != TerrainLod::CDLOD && !m_terrain.texturesResident())
+    {
+        vkInstance.waitIdle();
+
+        m_terrain.uploadTextures();
+        bindDescriptors();
+    }
+
+    CpuTimer timer;
+
     bool drawWater = !m_wireframe && m_drawWater;
 
     m_mainView.update(m_width, m_height);
+
+    m_frameCount++;
+
+    // Skip ratio counts frames with water requested only, wireframe and hidden water are not skips
+    if (drawWater)
+    {
+        m_mainView.updateWater(WaterLevel, WaterExtent);
+
+        if (!m_mainView.waterVisible())
+        {
+            drawWater = false;
+            m_waterSkipCount++;
+        }
+
+        m_profiler.add("water skipped (ratio)", drawWater ? 0.0 : 1.0);
+    }
+
+    m_profiler.add("water tiles", drawWater ? double(m_mainView.waterTileCount()) : 0.0);
+
+    bool planarReflection = drawWater && m_reflectionMode == ReflectionMode::Planar;
+
     m_reflectionView.reflect(m_mainView, WaterLevel);
 
     m_mainView.updateVisibility();
 
-    if (drawWater) m_reflStartEvent.signal(); 
+    // Streamed terrain data is uploaded before reflection and main passes are submitted
+    bool clipmapUpload = m_terrain.lod() == TerrainLod::Clipmap && m_clipmap.update(m_camera.pos());
+    bool pageUpload = m_terrain.lod() == TerrainLod::CDLOD && m_terrain.virtualHeightmap().update();
+
+    if (clipmapUpload || pageUpload)
+    {
+        m_uploadCommandList.begin();
+        if (clipmapUpload) m_clipmap.upload(m_uploadCommandList);
+        if (pageUpload) m_terrain.virtualHeightmap().upload(m_uploadCommandList);
+        m_uploadCommandList.finish();
+
+        vkInstance.submit(m_uploadCommandList);
+    }
+
+    if (clipmapUpload) m_profiler.add("clipmap texels uploaded (K)", m_clipmap.uploadedTexels() * 1e-3);
+
+    if (m_terrain.lod() == TerrainLod::CDLOD)
+    {
+        m_profiler.add("heightmap pages resident", double(m_terrain.virtualHeightmap().residentPages()));
+        m_profiler.add("heightmap pages uploaded", pageUpload ? double(m_terrain.virtualHeightmap().uploadedPages()) : 0.0);
+    }
+
+    bool refreshReflection = planarReflection && updateReflectionState();
+    if (!planarReflection) m_reflValid = false;
+
+    if (refreshReflection) m_reflStartEvent.signal(); 
 
     m_mainCommandList.begin();
+    m_mainCommandList.resetQueries(m_timestamps, ts_frame_begin, 2);
+    m_mainCommandList.resetQueries(m_timestamps, ts_terrain_begin, 2);
+    m_mainCommandList.resetQueries(m_statistics, 0, stat_count);
+    m_mainCommandList.writeTimestamp(m_timestamps, ts_frame_begin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
     if (m_wireframe) 
         m_mainCommandList.clearColor(0.0f, 0.0f, 0.0f);
     else 
         m_mainCommandList.clearColor(BgColor.r, BgColor.g, BgColor.b);
 
+    // Opaque scene goes offscreen when water needs to sample it, otherwise directly to swapchain
+    VkImageView sceneTarget = drawWater ? VkImageView(m_sceneColor) : m_swapchain.colorBuffer(bufferIndex);
+
     m_mainCommandList.barrier(m_swapchain.image(bufferIndex), VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    if (drawWater) m_mainCommandList.barrier(m_sceneColor, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     m_mainCommandList.barrier(m_depth, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-    m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), m_swapchain.colorBuffer(bufferIndex), m_depth);
+    m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), sceneTarget, m_depth.attachmentView());
 
     m_mainCommandList.setViewport(m_width, m_height);
     m_mainCommandList.setPolygonMode(m_wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL);
     m_mainCommandList.setCullMode(VK_CULL_MODE_BACK_BIT);
 
+    bool drawSky = !m_wireframe;
+
     // Sky
-    if (!m_wireframe)
+    if (!m_lateSky)
     {
-        m_mainCommandList.bindPipeline(m_skyPipeline);
-        m_mainCommandList.bindDescriptorSet(m_skyDescriptors);
-
-        m_mainCommandList.setConstant(0, m_animTime);
-        m_skydome.display(m_mainCommandList);
+        m_mainCommandList.beginQuery(m_statistics, stat_sky);
+        if (drawSky) displaySky(m_mainCommandList, m_skyDescriptors, false);
+        m_mainCommandList.endQuery(m_statistics, stat_sky);
     }
 
     // Terrain
-    m_mainCommandList.bindPipeline(m_terrainPipeline);
-    m_mainCommandList.bindDescriptorSet(m_terrainDescriptors);
-    m_mainCommandList.setConstant(8, VkBool32(VK_FALSE));
+    m_mainCommandList.writeTimestamp(m_timestamps, ts_terrain_begin, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    m_mainCommandList.beginQuery(m_statistics, stat_terrain);
+
+    if (m_terrain.lod() == TerrainLod::Clipmap)
+    {
+        m_mainCommandList.bindPipeline(m_clipmapPipeline);
+        m_mainCommandList.bindDescriptorSet(m_clipmapDescriptors);
+
+        m_clipmap.display(m_mainCommandList);
+    }
+    else if (m_terrain.lod() == TerrainLod::Tessellation)
+    {
+        m_mainCommandList.bindPipeline(m_terrainTessPipeline);
+        m_mainCommandList.bindDescriptorSet(m_terrainTessDescriptors);
+
+        m_mainView.displayTerrainPatches(m_mainCommandList, m_height);
+    }
+    else if (m_terrainMode == TerrainMode::DepthPrepass)
+    {
+        // Pipelines share descriptor set layout with main terrain pipeline
+        m_mainCommandList.bindPipeline(m_terrainDepthPipeline);
+        m_mainCommandList.bindDescriptorSet(m_terrainDescriptors);
+
+        m_mainView.displayTerrain(m_mainCommandList);
+
+        m_mainCommandList.bindPipeline(m_terrainEqualPipeline);
+        m_mainCommandList.bindDescriptorSet(m_terrainDescriptors);
 
-    m_mainView.displayTerrain(m_mainCommandList);
+        m_mainView.displayTerrain(m_mainCommandList);
+    }
+    else
+    {
+        m_mainCommandList.bindPipeline(m_terrainPipeline);
+        m_mainCommandList.bindDescriptorSet(m_terrainDescriptors);
+
+        m_mainView.displayTerrain(m_mainCommandList);
+    }
+
+    m_mainCommandList.endQuery(m_statistics, stat_terrain);
+    m_mainCommandList.writeTimestamp(m_timestamps, ts_terrain_end);
+
+    if (m_lateSky)
+    {
+        m_mainCommandList.beginQuery(m_statistics, stat_sky);
+        if (drawSky) displaySky(m_mainCommandList, m_skyDescriptors, true);
+        m_mainCommandList.endQuery(m_statistics, stat_sky);
+    }
 
     // Water
     if (drawWater)
     {
         float fogParams[5] = { WaterColor.x, WaterColor.y, WaterColor.z, WaterFogDensity, WaterLevel };
 
-        m_mainCommandList.finishRender();
-
-        m_mainCommandList.barrier(m_depth, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), m_swapchain.colorBuffer(bufferIndex));
+        uint32_t screenSize[2] = { m_width, m_height };
+        uint32_t wavesSlot = m_waveSlots[uint32_t(m_waveAnimFrame)];
 
-        m_mainCommandList.bindPipeline(m_fogPipeline);
-        m_mainCommandList.bindDescriptorSet(m_fogDescriptors);
+        uint32_t waterFeatures = 0;
 
-        m_mainCommandList.setConstant(0, fogParams, VK_SHADER_STAGE_FRAGMENT_BIT);
-        m_mainCommandList.draw(4);
+        if (m_camera.pos().y > WaterLevel)
+            waterFeatures = WaterReflection | (m_reflectionMode == ReflectionMode::ScreenSpace ? WaterScreenSpace : 0);
 
-        m_mainCommandList.finishRender();
+        bool underwater = m_mainView.underwater();
+        bool separate = m_waterShading == WaterShading::Separate;
 
-        m_mainCommandList.barrier(m_swapchain.image(bufferIndex), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-        m_mainCommandList.barrier(m_background, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        m_mainCommandList.copyImage(m_swapchain.image(bufferIndex), m_background, m_width, m_height);
-        m_mainCommandList.barrier(m_swapchain.image(bufferIndex), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        m_mainCommandList.barrier(m_background, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        // Above water fog is limited to pixels where water surface is in front of terrain
+        if (separate && !underwater)
+        {
+            m_mainCommandList.bindPipeline(m_waterMaskPipeline);
+            m_mainCommandList.bindDescriptorSet(m_waterMaskDescriptors);
+            m_mainCommandList.setConstant(16, WaterLevel);
+            m_mainView.displayWater(m_mainCommandList);
+        }
 
-        m_mainCommandList.barrier(m_reflection, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), m_swapchain.colorBuffer(bufferIndex));
-        m_mainCommandList.bindPipeline(m_waterPipeline);
-        m_mainCommandList.bindDescriptorSet(m_waterDescriptors[m_waveAnimFrame]);
+        m_mainCommandList.finishRender();
 
-        uint32_t reflectionParams[3] = { m_camera.pos().y > WaterLevel ? 1 : 0, m_width, m_height };
-        m_mainCommandList.setConstant(4, reflectionParams, VK_SHADER_STAGE_FRAGMENT_BIT);
-        m_mainCommandList.draw(4);
+        m_mainCommandList.barrier(m_depth, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+        if (separate)
+        {
+            m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), sceneTarget, 
+                                              m_depth.attachmentView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+            m_mainCommandList.bindPipeline(m_fogPipeline);
+            m_mainCommandList.bindDescriptorSet(m_fogDescriptors);
+
+            m_mainCommandList.setStencilTest(!underwater);
+            m_mainCommandList.setConstant(0, fogParams, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+            glm::vec4 bounds = underwater ? glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f) : m_mainView.waterScreenBounds();
+
+            int32_t x0 = int32_t(floorf((bounds.x * 0.5f + 0.5f) * m_width));
+            int32_t x1 = int32_t(ceilf((bounds.z * 0.5f + 0.5f) * m_width));
+            int32_t y0 = int32_t(floorf((0.5f - bounds.w * 0.5f) * m_height));
+            int32_t y1 = int32_t(ceilf((0.5f - bounds.y * 0.5f) * m_height));
+
+            m_profiler.add("fog scissor (% of screen)", 100.0 * std::max(x1 - x0, 0) * std::max(y1 - y0, 0) / (double(m_width) * m_height));
+
+            if (x1 > x0 && y1 > y0)
+            {
+                m_mainCommandList.setScissor(x0, y0, x1 - x0, y1 - y0);
+                m_mainCommandList.draw(4);
+                m_mainCommandList.setScissor(0, 0, m_width, m_height);
+            }
+
+            m_mainCommandList.finishRender();
+        }
+
+        m_mainCommandList.barrier(m_sceneColor, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        if (refreshReflection) m_mainCommandList.barrier(m_reflection, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        // Final pass: composite opaque scene to swapchain and shade water
+        m_mainCommandList.bindFrameBuffer(m_swapchain.frameExtent(), m_swapchain.colorBuffer(bufferIndex), 
+                                          m_depth.attachmentView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+        if (separate)
+        {
+            m_mainCommandList.bindPipeline(m_compositePipeline);
+            m_mainCommandList.bindDescriptorSet(m_compositeDescriptors);
+            m_mainCommandList.draw(4);
+
+            m_mainCommandList.bindPipeline(m_waterPipeline, waterFeatures);
+            m_mainCommandList.bindDescriptorSet(m_waterDescriptors);
+
+            m_mainCommandList.setConstant(16, WaterLevel);
+            m_mainCommandList.setConstant(24, screenSize, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainCommandList.setConstant(32, wavesSlot, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainView.displayWater(m_mainCommandList);
+        }
+        else
+        {
+            m_mainCommandList.bindPipeline(m_waterCompositePipeline, waterFeatures);
+            m_mainCommandList.bindDescriptorSet(m_waterCompositeDescriptors);
+
+            m_mainCommandList.setConstant(0, fogParams, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainCommandList.setConstant(24, screenSize, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainCommandList.setConstant(32, wavesSlot, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainCommandList.setConstant(36, WaterExtent, VK_SHADER_STAGE_FRAGMENT_BIT);
+            m_mainCommandList.draw(4);
+        }
     }
 
     if (m_debugDraw)
@@ -414,9 +1096,17 @@ void App::display()
 
     m_mainCommandList.finishRender();
     m_mainCommandList.barrier(m_swapchain.image(bufferIndex), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    m_mainCommandList.writeTimestamp(m_timestamps, ts_frame_end);
     m_mainCommandList.finish();
+
+    m_profiler.add("CPU main (ms)", timer.elapsed());
     
-    if (drawWater) m_reflEndEvent.wait();
+    if (refreshReflection) m_reflEndEvent.wait();
     vkInstance.submit(m_mainCommandList);
     m_swapchain.present();
+
+    if (m_frameCount == 1) StartupTimeline::GetInstance().add("first frame", 0.0, StartupTimeline::GetInstance().now());
+
+    m_frameQueries = true;
+    m_reflQueries = refreshReflection;
 }
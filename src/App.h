@@ -5,17 +5,80 @@
 #include "Render/Render.h"
 
 #include "Resources/Image.h"
+#include "Resources/TextureBatch.h"
 
 #include "View.h"
 #include "SkyDome.h"
+#include "Clipmap.h"
 #include "Terrain.h"
 
 #include "Sync.h"
+#include "Profiler.h"
 
 #include <thread>
 #include <vector>
 #include <memory>
 
+enum class ReflectionMode
+{
+    Planar,         // Scene rendered from reflected camera
+    ScreenSpace     // Ray marching through main depth buffer
+};
+
+enum class WaterShading
+{
+    Separate,       // Fog blend, scene composite and water surface as separate passes
+    Combined        // Single full-screen pass evaluating fog, refraction and reflection
+};
+
+enum class TerrainMode
+{
+    Unsorted,       // Tiles in quadtree traversal order
+    Sorted,         // Tiles sorted front to back
+    DepthPrepass    // Sorted tiles, depth-only pass followed by equal-depth color pass
+};
+
+enum class ReflectionUpdate
+{
+    EveryFrame,
+    Interval,       // Full refresh when camera drifts too far or after ReflectionMaxInterval frames
+    Halves          // Same as Interval but only one half of the image is rendered per refresh
+};
+
+struct WaterConstantBuffer
+{
+    glm::mat4 reflViewProj[2];  // Reflected view-projection used for the last refresh of each image half
+    glm::vec4 skyColor;         // Screen-space reflection miss color
+};
+
+enum TimestampQuery
+{
+    ts_frame_begin,
+    ts_frame_end,
+    ts_refl_begin,
+    ts_refl_end,
+    ts_terrain_begin,
+    ts_terrain_end,
+    ts_count
+};
+
+enum StatisticsQuery
+{
+    stat_sky,
+    stat_terrain,
+    stat_count
+};
+
+// Values of each statistics query, in pipeline statistic bit order
+enum StatisticsValue
+{
+    stat_ia_vertices,
+    stat_vs_invocations,
+    stat_fs_invocations,
+    stat_tes_invocations,
+    stat_value_count
+};
+
 enum Key
 {
     key_up = 1,
@@ -32,21 +95,39 @@ class App
     Render::SwapChain m_swapchain;
 
     Render::Pipeline m_skyPipeline;
+    Render::Pipeline m_skyLatePipeline;
     Render::Pipeline m_terrainPipeline;
+    Render::Pipeline m_terrainDepthPipeline;
+    Render::Pipeline m_terrainEqualPipeline;
+    Render::Pipeline m_terrainTessPipeline;
+    Render::Pipeline m_clipmapPipeline;
     Render::Pipeline m_fogPipeline;
     Render::Pipeline m_waterPipeline;
+    Render::Pipeline m_waterMaskPipeline;
+    Render::Pipeline m_compositePipeline;
+    Render::Pipeline m_waterCompositePipeline;
     Render::Pipeline m_debugPipeline;
     
     Render::DescriptorSet m_skyDescriptors;
     Render::DescriptorSet m_skyReflDescriptors;
     Render::DescriptorSet m_terrainDescriptors;
     Render::DescriptorSet m_terrainReflDescriptors;
+    Render::DescriptorSet m_terrainTessDescriptors;
+    Render::DescriptorSet m_terrainTessReflDescriptors;
+    Render::DescriptorSet m_clipmapDescriptors;
+    Render::DescriptorSet m_clipmapReflDescriptors;
     Render::DescriptorSet m_fogDescriptors;
-    std::vector<Render::DescriptorSet> m_waterDescriptors;
+    Render::DescriptorSet m_waterDescriptors;
+    Render::DescriptorSet m_waterCompositeDescriptors;
+    Render::DescriptorSet m_waterMaskDescriptors;
+    Render::DescriptorSet m_compositeDescriptors;
     Render::DescriptorSet m_debugDescriptors;
 
     Render::CommandList m_mainCommandList;
     Render::CommandList m_reflCommandList;
+    Render::CommandList m_uploadCommandList;   // Submitted ahead of reflection and main passes
+
+    TextureBatch m_textureBatch;                // Decodes images below while terrain is built
 
     std::unique_ptr<Image> m_grass;
     std::unique_ptr<Image> m_dirt;
@@ -59,6 +140,18 @@ class App
     std::unique_ptr<Image> m_clouds;
     std::vector<std::unique_ptr<Image>> m_waves;
 
+    // Bound in place of batch textures until they are decoded and uploaded
+    std::unique_ptr<Image> m_placeholderColor;
+    std::unique_ptr<Image> m_placeholderNormal;
+    std::unique_ptr<Image> m_placeholderSky;
+    bool m_texturesLoaded = false;
+
+    // Texture table slots: grass, dirt, rock diffuse then normal maps, sky clouds, wave animation frames
+    uint32_t m_materialSlots[6];
+    uint32_t m_cloudsSlot;
+    std::vector<uint32_t> m_waveSlots;
+    bool m_startupReported = false;
+
     Render::Sampler m_sampler;
     Render::Sampler m_clampSampler;
 
@@ -67,14 +160,17 @@ class App
     Render::IndexBuffer m_boxIBuffer;
 
     Render::Bitmap m_depth;
-    Render::Bitmap m_background;       // Frame buffer copy for water refraction;
+    Render::Bitmap m_sceneColor;       // Opaque scene, sampled by water for refraction
     Render::Bitmap m_reflection;
     Render::Bitmap m_reflDepth;
 
     Render::FrameBuffer m_reflFramebuffer;
 
+    Render::ConstantBuffer<WaterConstantBuffer> m_waterConstantBuffer;
+
     SkyDome m_skydome;
     Terrain m_terrain;
+    Clipmap m_clipmap;
 
     View m_mainView;
     View m_reflectionView;
@@ -85,6 +181,24 @@ class App
     Event m_reflStartEvent;
     Event m_reflEndEvent;
 
+    TerrainMode m_terrainMode;
+    WaterShading m_waterShading;
+    ReflectionMode m_reflectionMode;
+    ReflectionUpdate m_reflectionUpdate;
+    bool m_reflValid;
+    uint32_t m_reflHalf;            // Image region rendered by the current refresh
+    uint32_t m_reflFrames;          // Frames since the last refresh
+    glm::vec3 m_reflCameraPos;      // Camera state at the last refresh
+    glm::vec2 m_reflCameraAngles;
+
+    Render::QueryPool m_timestamps;
+    Render::QueryPool m_statistics;
+    Profiler m_profiler;
+
+    bool m_frameQueries;
+    bool m_reflQueries;
+    double m_reflCpuTime;
+
     bool m_terminate = false;
 
     float m_ang = 0;
@@ -94,6 +208,10 @@ class App
     bool m_debugDraw;
     bool m_wireframe;
     bool m_drawWater;
+    bool m_lateSky;                 // Sky drawn after terrain, only visible pixels are shaded
+
+    uint64_t m_frameCount;
+    uint64_t m_waterSkipCount;      // Frames where water chain was skipped by visibility test
 
     float m_speed;
     float m_animTime;
@@ -110,16 +228,47 @@ class App
 
     static constexpr glm::vec3 WaterColor = glm::vec3(0.11, 0.27, 0.21);
     static constexpr float WaterFogDensity = 0.25f;
-    static constexpr float WaterLevel = 10.0f;
+    static constexpr float WaterExtent = 3000.0f;       // Half size of water surface around camera
 
     static constexpr size_t WavesFrameNum = 8;
 
+    static constexpr uint32_t ReflectionLeft = 0;
+    static constexpr uint32_t ReflectionRight = 1;
+    static constexpr uint32_t ReflectionFull = 2;
+
+    static constexpr uint32_t ReflectionMaxInterval = 16;
+    static constexpr float ReflectionMaxDrift = 0.5f;
+    static constexpr float ReflectionAngleWeight = 0.1f;    // Drift per degree of camera rotation
+
 private:
+    void switchReflectionMode();
+    void switchReflectionUpdate();
+    void startReflectionBenchmark();
+    void switchWaterShading();
+    void startWaterBenchmark();
+    void switchSkyOrder();
+    void switchTerrainMode();
+    void setTerrainMode(TerrainMode mode);
+    void startTerrainBenchmark();
+    void switchIndexOrder();
+    void switchTileGrid();
+    void switchTerrainLod();
+    void displaySky(Render::CommandList& commandList, const Render::DescriptorSet& descriptors, bool late);
+
+    void collectStats();
+
+    void bindDescriptors();
+    void bindTextures();
+    void updateStreaming();
+
+    bool updateReflectionState();
     void displayReflection();
     void reflectionThread();
 
 public:
-    App(VkSurfaceKHR surface);
+    static constexpr float WaterLevel = 10.0f;
+
+    App(VkSurfaceKHR surface, NormalFormat normalFormat = NormalFormat::RGBA8);
     ~App();
 
     void initBoxGeometry();
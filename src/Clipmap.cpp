@@ -0,0 +1,208 @@
+#include <glm/glm.hpp>
+
+#include "Clipmap.h"
+
+#include <cmath>
+#include <algorithm>
+
+Clipmap::Clipmap(Terrain& terrain)
+: m_terrain(terrain)
+, m_texture(VK_FORMAT_R16_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+{
+    m_texture.reset(TextureSize, TextureSize, Levels);
+
+    // Worst case is full refresh of every level, each split in up to four aligned pieces
+    size_t stagingSize = Levels * (TextureSize * TextureSize * sizeof(uint16_t) + 4 * 4);
+    m_staging.reset(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingSize);
+
+    initGeometry();
+}
+
+void Clipmap::initGeometry()
+{
+    // Vertex (i, k) of the grid has index k * stride + i
+    constexpr uint32_t stride = GridSize + 1;
+    static_assert(stride * stride <= 65536, "Clipmap vertices must fit 16 bit indices");
+
+    std::vector<uint16_t> indices;
+
+    auto appendMesh = [&](TileMesh& mesh, bool hole, uint32_t a, uint32_t b)
+    {
+        mesh.first = uint32_t(indices.size());
+
+        // Finer level covers half of the grid, offset by one quad depending on camera position
+        uint32_t holeMin = GridSize / 4;
+        uint32_t holeMax = holeMin + GridSize / 2;
+
+        for (uint32_t k = 0; k < GridSize; k++)
+            for (uint32_t i = 0; i < GridSize; i++)
+            {
+                if (hole && i >= holeMin + a && i < holeMax + a && k >= holeMin + b && k < holeMax + b) continue;
+
+                uint16_t v = uint16_t(k * stride + i);
+
+                indices.push_back(v);
+                indices.push_back(v + 1);
+                indices.push_back(v + stride);
+
+                indices.push_back(v + stride);
+                indices.push_back(v + 1);
+                indices.push_back(v + stride + 1);
+            }
+
+        mesh.count = uint32_t(indices.size()) - mesh.first;
+    };
+
+    appendMesh(m_meshes[0], false, 0, 0);
+
+    for (uint32_t n = 0; n < 4; n++) appendMesh(m_meshes[n + 1], true, n & 1, n >> 1);
+
+    m_indexBuffer.setData(indices.data(), indices.size());
+}
+
+void Clipmap::stageRect(uint32_t level, int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+    const Image& heightmap = m_terrain.heightmap();
+    const uint16_t* data = reinterpret_cast<const uint16_t*>(heightmap.data);
+
+    int32_t maxX = int32_t(heightmap.width) - 1;
+    int32_t maxY = int32_t(heightmap.height) - 1;
+
+    // Split rectangle where it wraps around texture edges
+    int32_t wx = x & (TextureSize - 1);
+    int32_t wy = y & (TextureSize - 1);
+
+    uint32_t widths[2] = { std::min(width, TextureSize - wx), 0 };
+    uint32_t heights[2] = { std::min(height, TextureSize - wy), 0 };
+    widths[1] = width - widths[0];
+    heights[1] = height - heights[0];
+
+    for (uint32_t pk = 0; pk < 2; pk++)
+        for (uint32_t pi = 0; pi < 2; pi++)
+        {
+            if (widths[pi] == 0 || heights[pk] == 0) continue;
+
+            int32_t px = x + (pi ? widths[0] : 0);
+            int32_t py = y + (pk ? heights[0] : 0);
+
+            uint16_t* dst = reinterpret_cast<uint16_t*>(m_stagingData + m_stagingOffset);
+
+            // Point samples of source, so that coarse texels match finer level exactly
+            for (uint32_t k = 0; k < heights[pk]; k++)
+                for (uint32_t i = 0; i < widths[pi]; i++)
+                {
+                    int32_t sx = std::clamp((px + int32_t(i)) * (1 << level), 0, maxX);
+                    int32_t sy = std::clamp((py + int32_t(k)) * (1 << level), 0, maxY);
+
+                    *dst++ = data[sy * heightmap.width + sx];
+                }
+
+            VkBufferImageCopy copy = {};
+            copy.bufferOffset = m_stagingOffset;
+            copy.bufferRowLength = 0;
+            copy.bufferImageHeight = 0;
+            copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy.imageSubresource.mipLevel = 0;
+            copy.imageSubresource.baseArrayLayer = level;
+            copy.imageSubresource.layerCount = 1;
+            copy.imageOffset = { px & int32_t(TextureSize - 1), py & int32_t(TextureSize - 1), 0 };
+            copy.imageExtent = { widths[pi], heights[pk], 1 };
+
+            m_copies.push_back(copy);
+
+            m_stagingOffset += (widths[pi] * heights[pk] * sizeof(uint16_t) + 3) & ~size_t(3);
+            m_uploadedTexels += widths[pi] * heights[pk];
+        }
+}
+
+bool Clipmap::update(const glm::vec3& pos)
+{
+    const Image& heightmap = m_terrain.heightmap();
+
+    float texelSize = m_terrain.size() / heightmap.width;
+
+    glm::vec2 texel = (glm::vec2(pos.x, pos.z) + m_terrain.size() * 0.5f) / texelSize;
+
+    m_copies.clear();
+    m_stagingOffset = 0;
+    m_uploadedTexels = 0;
+
+    for (uint32_t level = 0; level < Levels; level++)
+    {
+        glm::ivec2 center = glm::ivec2(glm::floor(texel / float(2 << level))) * 2;
+
+        if (m_valid && center == m_centers[level]) continue;
+
+        if (!m_stagingData) m_stagingData = reinterpret_cast<uint8_t*>(m_staging.map(Levels * (TextureSize * TextureSize * sizeof(uint16_t) + 4 * 4)));
+
+        glm::ivec2 delta = center - m_centers[level];
+        glm::ivec2 rmin = center - int32_t(TextureSize / 2);
+
+        if (!m_valid || std::abs(delta.x) + std::abs(delta.y) >= int32_t(TextureSize))
+        {
+            stageRect(level, rmin.x, rmin.y, TextureSize, TextureSize);
+        }
+        else
+        {
+            // Columns and rows that entered the region replace the ones that left it
+            if (delta.x != 0)
+            {
+                int32_t x = delta.x > 0 ? rmin.x + int32_t(TextureSize) - delta.x : rmin.x;
+                stageRect(level, x, rmin.y, std::abs(delta.x), TextureSize);
+            }
+
+            if (delta.y != 0)
+            {
+                int32_t y = delta.y > 0 ? rmin.y + int32_t(TextureSize) - delta.y : rmin.y;
+                stageRect(level, rmin.x, y, TextureSize, std::abs(delta.y));
+            }
+        }
+
+        m_centers[level] = center;
+    }
+
+    m_valid = true;
+
+    if (m_stagingData)
+    {
+        m_staging.unmap();
+        m_stagingData = nullptr;
+    }
+
+    return !m_copies.empty();
+}
+
+void Clipmap::upload(Render::CommandList& commandList)
+{
+    commandList.barrier(m_texture, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    commandList.copyBufferToImage(m_staging, m_texture, m_copies);
+    commandList.barrier(m_texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void Clipmap::display(Render::CommandList& commandList) const
+{
+    const Image& heightmap = m_terrain.heightmap();
+
+    commandList.bindIndexBuffer(m_indexBuffer);
+
+    commandList.setConstant(0, m_terrain.size());
+    commandList.setConstant(4, m_terrain.height());
+    commandList.setConstant(24, m_terrain.size() / heightmap.width);
+    commandList.setConstant(28, Levels);
+    m_terrain.setFragmentConstants(commandList);
+
+    for (uint32_t level = 0; level < Levels; level++)
+    {
+        uint32_t mesh = 0;
+
+        if (level > 0)
+        {
+            glm::ivec2 offset = m_centers[level - 1] / 2 - m_centers[level];
+            mesh = 1 + offset.x + 2 * offset.y;
+        }
+
+        commandList.setConstant(12, level);
+        commandList.setConstant(16, m_centers[level]);
+        commandList.drawIndexed(m_meshes[mesh].count, m_meshes[mesh].first);
+    }
+}
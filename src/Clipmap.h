@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Render/Render.h"
+#include "Terrain.h"
+
+#include <vector>
+
+// Geometry clipmap: nested grids centered on camera, each level samples its layer of 
+// a texture array that is updated toroidally as camera moves
+class Clipmap
+{
+public:
+    Clipmap(Terrain& terrain);
+
+    // Moves levels with camera and stages texels that came into view, returns true if upload is needed
+    bool update(const glm::vec3& pos);
+    void upload(Render::CommandList& commandList);
+
+    void display(Render::CommandList& commandList) const;
+
+    const Render::Bitmap& texture() const { return m_texture; }
+    size_t uploadedTexels() const { return m_uploadedTexels; }
+
+    // Next update restages every level, used when terrain data is replaced
+    void invalidate() { m_valid = false; }
+
+    static constexpr uint32_t Levels = 8;
+    static constexpr uint32_t GridSize = 64;        // Quads per level side
+    static constexpr uint32_t TextureSize = 128;    // Texels per level side, power of two for wrap addressing
+
+private:
+    void initGeometry();
+    void stageRect(uint32_t level, int32_t x, int32_t y, uint32_t width, uint32_t height);
+
+private:
+    Terrain& m_terrain;
+
+    Render::Bitmap m_texture;
+    Render::Buffer m_staging;
+    uint8_t* m_stagingData = nullptr;
+    size_t m_stagingOffset = 0;
+    std::vector<VkBufferImageCopy> m_copies;
+
+    Render::IndexBuffer m_indexBuffer;
+    TileMesh m_meshes[5];               // Full grid, then rings with hole offset (a, b) at 1 + a + 2 * b
+
+    glm::ivec2 m_centers[Levels];       // Level center in level texels, always even
+    bool m_valid = false;
+    size_t m_uploadedTexels = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Set on threads running a ParallelFor chunk, nested loops then run serially instead of oversubscribing
+inline thread_local bool t_parallelWorker = false;
+
+// Runs func(i) for every i in [begin, end), range is split in contiguous chunks, one per hardware thread
+template<class Func>
+void ParallelFor(uint32_t begin, uint32_t end, Func&& func)
+{
+    uint32_t count = end > begin ? end - begin : 0;
+    uint32_t threads = t_parallelWorker ? 1 : std::min(std::max(std::thread::hardware_concurrency(), 1u), count);
+
+    auto run = [&](uint32_t t)
+    {
+        uint32_t first = begin + uint32_t(uint64_t(count) * t / threads);
+        uint32_t last = begin + uint32_t(uint64_t(count) * (t + 1) / threads);
+
+        bool worker = t_parallelWorker;
+        t_parallelWorker = true;
+
+        for (uint32_t i = first; i < last; i++) func(i);
+
+        t_parallelWorker = worker;
+    };
+
+    if (threads <= 1)
+    {
+        for (uint32_t i = begin; i < end; i++) func(i);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+
+    for (uint32_t t = 1; t < threads; t++) workers.emplace_back(run, t);
+
+    run(0);
+
+    for (std::thread& worker : workers) worker.join();
+}
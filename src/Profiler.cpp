@@ -0,0 +1,64 @@
+#include "Profiler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+void Profiler::add(const char* name, double value)
+{
+    if (!active() || m_frames < WarmupFrames) return;
+
+    for (Counter& counter : m_counters)
+    {
+        if (strcmp(counter.name, name) == 0)
+        {
+            counter.sum += value;
+            return;
+        }
+    }
+
+    m_counters.push_back({ name, value });
+}
+
+void Profiler::start(std::vector<BenchmarkStage> stages)
+{
+    m_stages = std::move(stages);
+    m_stage = 0;
+
+    reset();
+
+    if (active()) m_stages[0].setup();
+}
+
+void Profiler::reset()
+{
+    m_counters.clear();
+    m_frames = 0;
+}
+
+void Profiler::nextFrame()
+{
+    if (!active()) return;
+
+    m_frames++;
+
+    if (m_frames < WarmupFrames + StageFrames) return;
+
+    report();
+    reset();
+
+    m_stage++;
+
+    if (active()) m_stages[m_stage].setup();
+}
+
+void Profiler::report() const
+{
+    std::cout << "Benchmark [" << m_stages[m_stage].name << "] " << StageFrames << " frames" << std::endl;
+
+    for (const Counter& counter : m_counters)
+    {
+        std::cout << "    " << std::left << std::setw(28) << counter.name 
+                  << std::fixed << std::setprecision(3) << counter.sum / StageFrames << std::endl;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+
+class CpuTimer
+{
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    CpuTimer() : m_start(std::chrono::steady_clock::now()) {}
+
+    void reset() { m_start = std::chrono::steady_clock::now(); }
+
+    // Milliseconds since construction/reset
+    double elapsed() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    }
+};
+
+struct BenchmarkStage
+{
+    std::string name;
+    std::function<void()> setup;
+};
+
+// Accumulates per-frame counters and runs a set of benchmark stages,
+// each stage is measured for a fixed number of frames
+class Profiler
+{
+public:
+    void add(const char* name, double value);
+
+    void start(std::vector<BenchmarkStage> stages);
+    void nextFrame();
+
+    bool active() const { return m_stage < m_stages.size(); }
+
+private:
+    void reset();
+    void report() const;
+
+private:
+    struct Counter
+    {
+        const char* name;
+        double sum;
+    };
+
+    std::vector<Counter> m_counters;
+    uint32_t m_frames = 0;
+
+    std::vector<BenchmarkStage> m_stages;
+    size_t m_stage = 0;
+
+    static constexpr uint32_t WarmupFrames = 32;
+    static constexpr uint32_t StageFrames = 512;
+};
@@ -10,6 +10,8 @@
 #include "Render/Vulkan/DescriptorSet.h"
 #include "Render/Vulkan/Sampler.h"
 #include "Render/Vulkan/Bitmap.h"
+#include "Render/Vulkan/QueryPool.h"
+#include "Render/Vulkan/TextureTable.h"
 
 #include "Render/Camera.h"
 #include "Render/Frustum.h"
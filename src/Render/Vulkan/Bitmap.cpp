@@ -12,6 +12,7 @@ Bitmap::Bitmap(VkFormat format, VkImageUsageFlags usage)
 , m_imageMemory(VK_NULL_HANDLE)
 , m_image(VK_NULL_HANDLE)
 , m_imageView(VK_NULL_HANDLE)
+, m_attachmentView(VK_NULL_HANDLE)
 {
 }
 
@@ -27,6 +28,7 @@ void Bitmap::reset()
         VulkanInstance& vkInstance = VulkanInstance::GetInstance();
 
         vkDestroyImageView(vkInstance.device(), m_imageView, nullptr);
+        if (m_attachmentView != VK_NULL_HANDLE) vkDestroyImageView(vkInstance.device(), m_attachmentView, nullptr);
         vkDestroyImage(vkInstance.device(), m_image, nullptr);
         vkFreeMemory(vkInstance.device(), m_imageMemory, nullptr);
     }
@@ -50,7 +52,21 @@ VkImageAspectFlags Bitmap::GetAspectMask(VkFormat format)
     return VK_IMAGE_ASPECT_COLOR_BIT;
 }
 
-void Bitmap::reset(uint32_t width, uint32_t height)
+bool Bitmap::HasStencil(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_S8_UINT:
+        return true;
+    }
+
+    return false;
+}
+
+void Bitmap::reset(uint32_t width, uint32_t height, uint32_t layers)
 {
     reset();
 
@@ -63,7 +79,7 @@ void Bitmap::reset(uint32_t width, uint32_t height)
     imageInfo.extent.height = static_cast<uint32_t>(height);
     imageInfo.extent.depth = 1;
     imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.arrayLayers = layers;
     imageInfo.format = m_format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -96,7 +112,7 @@ void Bitmap::reset(uint32_t width, uint32_t height)
     VkImageViewCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     createInfo.image = m_image;
-    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.viewType = layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
     createInfo.format = m_format;
 
     createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -108,13 +124,26 @@ void Bitmap::reset(uint32_t width, uint32_t height)
     createInfo.subresourceRange.baseMipLevel = 0;
     createInfo.subresourceRange.levelCount = 1;
     createInfo.subresourceRange.baseArrayLayer = 0;
-    createInfo.subresourceRange.layerCount = 1;
+    createInfo.subresourceRange.layerCount = layers;
 
     if (vkCreateImageView(vkInstance.device(), &createInfo, nullptr, &m_imageView) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create image views!");
     }
 
+    // Sampled view holds depth only, attachments need both depth and stencil
+    m_attachmentView = VK_NULL_HANDLE;
+
+    if (HasStencil(m_format) && createInfo.subresourceRange.aspectMask != VK_IMAGE_ASPECT_STENCIL_BIT)
+    {
+        createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+
+        if (vkCreateImageView(vkInstance.device(), &createInfo, nullptr, &m_attachmentView) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create image views!");
+        }
+    }
+
     m_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 }
 
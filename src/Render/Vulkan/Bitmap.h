@@ -14,6 +14,7 @@ class Bitmap
     VkDeviceMemory m_imageMemory;
     VkImage m_image;
     VkImageView m_imageView;
+    VkImageView m_attachmentView;
 
     VkImageLayout m_layout;
 
@@ -25,15 +26,18 @@ public:
     ~Bitmap();
 
     static VkImageAspectFlags GetAspectMask(VkFormat format);
+    static bool HasStencil(VkFormat format);
 
     void reset();
-    void reset(uint32_t width, uint32_t height);
+    void reset(uint32_t width, uint32_t height, uint32_t layers = 1);
 
     void setLayout(VkImageLayout layout);
 
     operator VkImage() const { return m_image; }
     operator VkImageView() const { return m_imageView; }
 
+    VkImageView attachmentView() const { return m_attachmentView != VK_NULL_HANDLE ? m_attachmentView : m_imageView; }
+
     friend class CommandList;
 };
 
@@ -2,8 +2,10 @@
 #include "Render/Vulkan/VulkanInstance.h"
 #include "Render/Vulkan/Bitmap.h"
 #include "Render/Vulkan/FrameBuffer.h"
+#include "Resources/Image.h"
 
 #include <stdexcept>
+#include <algorithm>
 
 namespace Render
 {
@@ -90,6 +92,15 @@ void CommandList::setViewport(uint32_t width, uint32_t height)
     vkCmdSetScissor(m_commandBuffer, 0, 1, &scissor);
 }
 
+void CommandList::setScissor(int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+    VkRect2D scissor = {};
+    scissor.offset = { x, y };
+    scissor.extent = { width, height };
+
+    vkCmdSetScissor(m_commandBuffer, 0, 1, &scissor);
+}
+
 void CommandList::clearColor(float r, float g, float b, float a)
 {
     m_clearColor.float32[0] = r;
@@ -127,8 +138,10 @@ void CommandList::bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageVi
     vkCmdBeginRendering(m_commandBuffer, &renderInfo);
 }
 
-void CommandList::bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageView& colorBuffer, const VkImageView& depthBuffer)
+void CommandList::bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageView& colorBuffer, const VkImageView& depthBuffer, VkImageLayout depthLayout)
 {
+    bool readOnlyDepth = depthLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
     VkRenderingAttachmentInfo colorAttachmentInfo = {};
     colorAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
     colorAttachmentInfo.imageView = colorBuffer;
@@ -140,9 +153,9 @@ void CommandList::bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageVi
     VkRenderingAttachmentInfo depthAttachmentInfo = {};
     depthAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
     depthAttachmentInfo.imageView = depthBuffer;
-    depthAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
-    depthAttachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachmentInfo.imageLayout = depthLayout;
+    depthAttachmentInfo.loadOp = readOnlyDepth ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachmentInfo.storeOp = readOnlyDepth ? VK_ATTACHMENT_STORE_OP_NONE : VK_ATTACHMENT_STORE_OP_STORE;
     depthAttachmentInfo.clearValue.depthStencil = { 1.0f, 0 };
 
     VkRenderingInfo renderInfo = {};
@@ -167,6 +180,24 @@ void CommandList::bindPipeline(const Pipeline& graphicsPipeline)
 {
     vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
     m_layout = graphicsPipeline.pipelineLayout();
+
+    if (graphicsPipeline.textureTable()) bindTextureTable();
+}
+
+void CommandList::bindPipeline(const Pipeline& graphicsPipeline, uint32_t permutation)
+{
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline.permutation(permutation));
+    m_layout = graphicsPipeline.pipelineLayout();
+
+    if (graphicsPipeline.textureTable()) bindTextureTable();
+}
+
+// Set 1 stays valid while set 0 is rebound with the same pipeline layout
+void CommandList::bindTextureTable()
+{
+    VkDescriptorSet textureTable = VulkanInstance::GetInstance().textureTable();
+
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_layout, 1, 1, &textureTable, 0, nullptr);
 }
 
 void CommandList::bindIndexBuffer(VkBuffer buffer)
@@ -200,6 +231,11 @@ void CommandList::setCullMode(VkCullModeFlags mode)
     vkCmdSetCullMode(m_commandBuffer, mode);
 }
 
+void CommandList::setStencilTest(bool enable)
+{
+    vkCmdSetStencilTestEnable(m_commandBuffer, enable ? VK_TRUE : VK_FALSE);
+}
+
 void CommandList::bind(uint32_t binding, VkBuffer buffer, VkDeviceSize size)
 {
     VkDescriptorBufferInfo bufferInfo{};
@@ -270,14 +306,34 @@ void CommandList::bind(uint32_t binding, VkImageView image)
                            &writeInfo);
 }
 
+void CommandList::resetQueries(VkQueryPool queryPool, uint32_t first, uint32_t count)
+{
+    vkCmdResetQueryPool(m_commandBuffer, queryPool, first, count);
+}
+
+void CommandList::writeTimestamp(VkQueryPool queryPool, uint32_t query, VkPipelineStageFlagBits stage)
+{
+    vkCmdWriteTimestamp(m_commandBuffer, stage, queryPool, query);
+}
+
+void CommandList::beginQuery(VkQueryPool queryPool, uint32_t query)
+{
+    vkCmdBeginQuery(m_commandBuffer, queryPool, query, 0);
+}
+
+void CommandList::endQuery(VkQueryPool queryPool, uint32_t query)
+{
+    vkCmdEndQuery(m_commandBuffer, queryPool, query);
+}
+
 void CommandList::draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
 {
     vkCmdDraw(m_commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
 }
 
-void CommandList::drawIndexed(uint16_t num)
+void CommandList::drawIndexed(uint32_t num, uint32_t first)
 {
-    vkCmdDrawIndexed(m_commandBuffer, num, 1, 0, 0, 0);
+    vkCmdDrawIndexed(m_commandBuffer, num, 1, first, 0, 0);
 }
 
 void CommandList::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, size_t size)
@@ -306,7 +362,7 @@ void CommandList::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t wid
     vkCmdCopyBufferToImage(m_commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 }
 
-void CommandList::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, size_t mipmaps)
+void CommandList::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, size_t mipmaps, VkFormat format)
 {
     std::vector<VkBufferImageCopy> copyRegion(mipmaps);
 
@@ -326,15 +382,20 @@ void CommandList::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t wid
         copyRegion[i].imageOffset = { 0, 0, 0 };
         copyRegion[i].imageExtent = { width, height, 1 };
 
-        offset += width * height * sizeof(uint32_t);
+        offset += levelsize(format, width, height);
 
-        width /= 2;
-        height /= 2;
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
     }
 
     vkCmdCopyBufferToImage(m_commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipmaps, copyRegion.data());
 }
 
+void CommandList::copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<VkBufferImageCopy>& regions)
+{
+    vkCmdCopyBufferToImage(m_commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+}
+
 void CommandList::copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height)
 {
     VkImageCopy copyRegion = {};
@@ -358,21 +419,51 @@ void CommandList::blitImage(VkImage src,
                             const VkOffset3D& srcOffsetMax,
                             const VkOffset3D& dstOffsetMin,
                             const VkOffset3D& dstOffsetMax,
-                            VkFilter filter)
+                            VkFilter filter,
+                            uint32_t srcMip,
+                            uint32_t dstMip)
 {
     VkImageBlit blitRegion {};
     blitRegion.srcOffsets[0] = srcOffsetMin;
     blitRegion.srcOffsets[1] = srcOffsetMax;
     blitRegion.dstOffsets[0] = dstOffsetMin;
     blitRegion.dstOffsets[1] = dstOffsetMax;
+    blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blitRegion.srcSubresource.mipLevel = srcMip;
+    blitRegion.srcSubresource.baseArrayLayer = 0;
+    blitRegion.srcSubresource.layerCount = 1;
+    blitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blitRegion.dstSubresource.mipLevel = dstMip;
+    blitRegion.dstSubresource.baseArrayLayer = 0;
+    blitRegion.dstSubresource.layerCount = 1;
 
     vkCmdBlitImage(m_commandBuffer,
-                    src, VK_IMAGE_LAYOUT_UNDEFINED,
-                    dst, VK_IMAGE_LAYOUT_UNDEFINED,
+                    src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                     1, &blitRegion,
                     filter);
 }
 
+void CommandList::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipmaps)
+{
+    for (uint32_t i = 1; i < mipmaps; i++)
+    {
+        int32_t srcWidth = std::max(width >> (i - 1), 1u);
+        int32_t srcHeight = std::max(height >> (i - 1), 1u);
+        int32_t dstWidth = std::max(width >> i, 1u);
+        int32_t dstHeight = std::max(height >> i, 1u);
+
+        // Previous level is complete once its own blit or copy finished
+        barrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, i - 1, 1);
+
+        blitImage(image, image, { 0, 0, 0 }, { srcWidth, srcHeight, 1 }, { 0, 0, 0 }, { dstWidth, dstHeight, 1 }, VK_FILTER_LINEAR, i - 1, i);
+
+        barrier(image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, i - 1, 1);
+    }
+
+    barrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipmaps - 1, 1);
+}
+
 void CommandList::reset()
 {
     vkResetCommandBuffer(m_commandBuffer, 0);
@@ -391,7 +482,7 @@ void CommandList::barrier(const VkImageMemoryBarrier& barrier,
     1, &barrier);
 }
 
-void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMip, uint32_t mipCount)
 {
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -401,10 +492,10 @@ void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseMipLevel = baseMip;
+    barrier.subresourceRange.levelCount = mipCount;
     barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
     barrier.srcAccessMask = 0;
     barrier.dstAccessMask = 0;
 
@@ -455,7 +546,7 @@ void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout
     if (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
     {
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dstStageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     }
     
     if (newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
@@ -464,6 +555,18 @@ void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout
         dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     }
 
+    if (oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+
+    if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        srcStageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+
     if (oldLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
     {
         barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
@@ -484,6 +587,22 @@ void CommandList::barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout
         barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
     }
 
+    if (oldLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+    {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+        dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
     if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
     {
         barrier.srcAccessMask = 0;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <vector>
 
 #include "Render/Vulkan/Pipeline.h"
 
@@ -29,21 +30,26 @@ public:
     void finish();
 
     void setViewport(uint32_t width, uint32_t height);
+    void setScissor(int32_t x, int32_t y, uint32_t width, uint32_t height);
 
     void clearColor(float r, float g, float b, float a = 1.0);
     
     void bindFrameBuffer(const VkRenderingInfo& renderInfo);
     void bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageView& colorBuffer);
-    void bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageView& colorBuffer, const VkImageView& depthBuffer);
+    void bindFrameBuffer(const VkExtent2D& frameExtent, const VkImageView& colorBuffer, const VkImageView& depthBuffer, 
+                         VkImageLayout depthLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
     void finishRender();
 
     void bindPipeline(const Pipeline& graphicsPipeline);
+    void bindPipeline(const Pipeline& graphicsPipeline, uint32_t permutation);
     void bindIndexBuffer(VkBuffer buffer);
     void bindVertexBuffer(VkBuffer buffer);
     void bindDescriptorSet(VkDescriptorSet descriptorSet);
+    void bindTextureTable();
 
     void setPolygonMode(VkPolygonMode mode);
     void setCullMode(VkCullModeFlags mode);
+    void setStencilTest(bool enable);
 
     void bind(uint32_t binding, VkBuffer buffer, VkDeviceSize size);
     void bind(uint32_t binding, VkImageView image, VkSampler sampler);
@@ -55,28 +61,42 @@ public:
         vkCmdPushConstants(m_commandBuffer, m_layout, flags, offset, sizeof(T), &value);
     }
 
+    void resetQueries(VkQueryPool queryPool, uint32_t first, uint32_t count);
+    void writeTimestamp(VkQueryPool queryPool, uint32_t query, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    void beginQuery(VkQueryPool queryPool, uint32_t query);
+    void endQuery(VkQueryPool queryPool, uint32_t query);
+
     void draw(uint32_t vertexCount, uint32_t instanceCount = 1, uint32_t firstVertex = 0, uint32_t firstInstance = 0);
-    void drawIndexed(uint16_t num);
+    void drawIndexed(uint32_t num, uint32_t first = 0);
 
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, size_t size);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, size_t mipmaps);
+    // Levels are packed one after another, block-compressed levels take whole blocks
+    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, size_t mipmaps, VkFormat format);
+    void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<VkBufferImageCopy>& regions);
 
     void copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height);
 
+    // Source level is expected in transfer source layout, destination level in transfer destination layout
     void blitImage(VkImage src,
                    VkImage dst,
                    const VkOffset3D& srcOffsetMin,
                    const VkOffset3D& srcOffsetMax,
                    const VkOffset3D& dstOffsetMin,
                    const VkOffset3D& dstOffsetMax,
-                   VkFilter filter);
+                   VkFilter filter,
+                   uint32_t srcMip = 0,
+                   uint32_t dstMip = 0);
+
+    // Fills levels 1..mipmaps-1 from level 0 by linear blits, all levels start in transfer destination
+    // layout and end shader readable
+    void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipmaps);
 
     void barrier(const VkImageMemoryBarrier& barrier,
                        VkPipelineStageFlags sourceStage,
                        VkPipelineStageFlags destinationStage);
 
-    void barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
+    void barrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t baseMip = 0, uint32_t mipCount = VK_REMAINING_MIP_LEVELS);
     void barrier(Bitmap& bitmap, VkImageLayout layout);
 
     void barrier(FrameBuffer& framebuffer, VkImageLayout layout);
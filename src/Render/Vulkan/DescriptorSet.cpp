@@ -43,10 +43,10 @@ void DescriptorSet::bind(uint32_t binding, VkBuffer buffer, VkDeviceSize size)
     vkUpdateDescriptorSets(VulkanInstance::GetInstance().device(), 1, &descriptorWrite, 0, nullptr);
 }
 
-void DescriptorSet::bind(uint32_t binding, VkImageView image, VkSampler sampler)
+void DescriptorSet::bind(uint32_t binding, VkImageView image, VkSampler sampler, VkImageLayout layout)
 {
     VkDescriptorImageInfo imageInfo{};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageLayout = layout;
     imageInfo.imageView = image;
     imageInfo.sampler = sampler;
 
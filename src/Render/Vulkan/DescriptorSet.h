@@ -13,7 +13,7 @@ public:
     DescriptorSet(VkDescriptorSetLayout layout);
 
     void bind(uint32_t binding, VkBuffer buffer, VkDeviceSize size);
-    void bind(uint32_t binding, VkImageView image, VkSampler sampler);
+    void bind(uint32_t binding, VkImageView image, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     void bind(uint32_t binding, uint32_t index, VkImageView image, VkSampler sampler);
 
     operator VkDescriptorSet() const { return m_descriptorSet; }
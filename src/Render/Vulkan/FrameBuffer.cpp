@@ -24,6 +24,11 @@ void FrameBuffer::resize(const VkExtent2D& frameExtent)
     m_renderInfo.renderArea = { {0, 0}, frameExtent };
 }
 
+void FrameBuffer::setRenderArea(const VkRect2D& area)
+{
+    m_renderInfo.renderArea = area;
+}
+
 void FrameBuffer::addColorAttachment(Bitmap& color)
 {
     m_colorBuffer = &color;
@@ -45,7 +50,7 @@ void FrameBuffer::addDepthAttachment(Bitmap& depth)
     m_depthBuffer = &depth;
 
     m_depthAttachmentInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-    m_depthAttachmentInfo.imageView = depth;
+    m_depthAttachmentInfo.imageView = depth.attachmentView();
     m_depthAttachmentInfo.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
     m_depthAttachmentInfo.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     m_depthAttachmentInfo.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
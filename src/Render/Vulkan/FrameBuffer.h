@@ -21,6 +21,7 @@ public:
     ~FrameBuffer() = default;
 
     void resize(const VkExtent2D& frameExtent);
+    void setRenderArea(const VkRect2D& area);
 
     void addColorAttachment(Bitmap& color);
     void addDepthAttachment(Bitmap& depth);
@@ -23,8 +23,20 @@ PhysicalDevice::PhysicalDevice(VkPhysicalDevice device)
     vkGetPhysicalDeviceProperties(m_device, &deviceProperties);
     vkGetPhysicalDeviceFeatures(m_device, &deviceFeatures);
 
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &indexingFeatures;
+    vkGetPhysicalDeviceFeatures2(m_device, &deviceFeatures2);
+
+    VkPhysicalDeviceIDProperties idProperties = {};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
     VkPhysicalDevicePushDescriptorProperties pushDescriptorProperties = {};
     pushDescriptorProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR;
+    pushDescriptorProperties.pNext = &idProperties;
 
     VkPhysicalDeviceProperties2 deviceProperties2 = {};
     deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
@@ -33,12 +45,38 @@ PhysicalDevice::PhysicalDevice(VkPhysicalDevice device)
 
     std::cout << deviceProperties.deviceName << std::endl;
 
-    m_suitable = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-                checkDeviceExtensionSupport() &&
+    m_timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+    m_properties = deviceProperties;
+    memcpy(m_driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+
+    // Optional, textures fall back to uncompressed formats without it
+    m_textureCompressionBC = deviceFeatures.textureCompressionBC;
+
+    // Any device type with the required features is accepted, software rasterizers like lavapipe included
+    m_suitable = checkDeviceExtensionSupport() &&
                 checkQueueFamilies() &&
                 pushDescriptorProperties.maxPushDescriptors > 0 &&
                 deviceFeatures.geometryShader &&
-                deviceFeatures.samplerAnisotropy;
+                deviceFeatures.samplerAnisotropy &&
+                deviceFeatures.pipelineStatisticsQuery &&
+                deviceFeatures.tessellationShader &&
+                indexingFeatures.runtimeDescriptorArray &&
+                indexingFeatures.descriptorBindingPartiallyBound &&
+                indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                indexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+}
+
+uint32_t PhysicalDevice::rank() const
+{
+    switch (m_properties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 0;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 1;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return 3;
+    default: return 4;
+    }
 }
 
 bool PhysicalDevice::checkDeviceExtensionSupport()
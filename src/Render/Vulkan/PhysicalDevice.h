@@ -15,6 +15,12 @@ private:
     VkPhysicalDevice m_device;
 
     bool m_suitable;
+    bool m_textureCompressionBC;
+
+    float m_timestampPeriod;
+
+    VkPhysicalDeviceProperties m_properties;
+    uint8_t m_driverUUID[VK_UUID_SIZE];
 
     uint32_t m_graphicsFamily;
     uint32_t m_presentationFamily;
@@ -32,11 +38,20 @@ public:
 
     bool isSuitable() { return m_suitable; }
 
+    // Selection order of suitable devices, lower is preferred: discrete, integrated, virtual, CPU
+    uint32_t rank() const;
+
     operator VkPhysicalDevice& () { return m_device; }
 
     uint32_t graphicsFamilyIndex() { return m_graphicsFamily; }
     uint32_t presentationFamilyIndex() { return m_presentationFamily; }
 
+    float timestampPeriod() const { return m_timestampPeriod; }
+    bool textureCompressionBC() const { return m_textureCompressionBC; }
+
+    const VkPhysicalDeviceProperties& properties() const { return m_properties; }
+    const uint8_t* driverUUID() const { return m_driverUUID; }
+
     bool findPresentationFamily(VkSurfaceKHR surface);
 
     uint32_t swapChainImageCount();
@@ -1,14 +1,28 @@
 #include "Pipeline.h"
 #include "Render/Vulkan/VulkanInstance.h"
 #include "Render/Vertex.h"
+#include "Timeline.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <stdexcept>
 
 namespace Render
 {
 
+static VkPipelineShaderStageCreateInfo shaderStage(VkShaderStageFlagBits stage, VkShaderModule module)
+{
+    VkPipelineShaderStageCreateInfo shaderStageInfo = {};
+    shaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStageInfo.stage = stage;
+    shaderStageInfo.module = module;
+    shaderStageInfo.pName = "main";
+
+    return shaderStageInfo;
+}
+
 Pipeline::Pipeline(const char* shader, 
                    const InputLayout& inputLayout,
                    const BindingLayout& bindingLayout,
@@ -21,7 +35,8 @@ Pipeline::Pipeline(const char* shader,
     VkShaderModule vertShaderModule = loadShader(vertexShaderPath.c_str());
     VkShaderModule fragShaderModule = loadShader(fragmentShaderPath.c_str());
 
-    init(vertShaderModule, fragShaderModule, inputLayout, bindingLayout, params);
+    init({ shaderStage(VK_SHADER_STAGE_VERTEX_BIT, vertShaderModule), 
+           shaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragShaderModule) }, inputLayout, bindingLayout, params);
 }
 
 Pipeline::Pipeline(const uint8_t* vertexShader, size_t vertexShaderSize,
@@ -33,43 +48,79 @@ Pipeline::Pipeline(const uint8_t* vertexShader, size_t vertexShaderSize,
     VkShaderModule vertShaderModule = buildShader(vertexShader, vertexShaderSize);
     VkShaderModule fragShaderModule = buildShader(fragmentShader, fragmentShaderSize);
 
-    init(vertShaderModule, fragShaderModule, inputLayout, bindingLayout, params);
+    init({ shaderStage(VK_SHADER_STAGE_VERTEX_BIT, vertShaderModule), 
+           shaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragShaderModule) }, inputLayout, bindingLayout, params);
 }
 
-void Pipeline::init(VkShaderModule vertShaderModule, 
-                    VkShaderModule fragShaderModule,
-                    const InputLayout& inputLayout,
-                    const BindingLayout& bindingLayout,
-                    const PipelineParameters& params)
+Pipeline::Pipeline(const uint8_t* vertexShader, size_t vertexShaderSize,
+                   const uint8_t* tessControlShader, size_t tessControlShaderSize,
+                   const uint8_t* tessEvalShader, size_t tessEvalShaderSize,
+                   const uint8_t* fragmentShader, size_t fragmentShaderSize,
+                   const InputLayout& inputLayout,
+                   const BindingLayout& bindingLayout,
+                   const PipelineParameters& params)
+{
+    VkShaderModule vertShaderModule = buildShader(vertexShader, vertexShaderSize);
+    VkShaderModule tescShaderModule = buildShader(tessControlShader, tessControlShaderSize);
+    VkShaderModule teseShaderModule = buildShader(tessEvalShader, tessEvalShaderSize);
+    VkShaderModule fragShaderModule = buildShader(fragmentShader, fragmentShaderSize);
+
+    init({ shaderStage(VK_SHADER_STAGE_VERTEX_BIT, vertShaderModule), 
+           shaderStage(VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT, tescShaderModule),
+           shaderStage(VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT, teseShaderModule),
+           shaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragShaderModule) }, inputLayout, bindingLayout, params);
+}
+
+// Everything pipeline creation reads, shared by builder threads of permutations
+struct PipelineState
+{
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    PipelineParameters params;
+    VkPipelineLayout layout;
+};
+
+static VkPipeline createGraphicsPipeline(const PipelineState& state, uint32_t features)
 {
     VulkanInstance& vkInstance = VulkanInstance::GetInstance();
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+    // Every feature bit used by some permutation is specialized explicitly, shader defaults don't matter
+    uint32_t featureMask = features;
+
+    for (uint32_t permutation : state.params.permutations) featureMask |= permutation;
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+    Specialization specialization = state.params.constants;
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    for (uint32_t bit = 0; bit < 32; bit++)
+        if (featureMask & (1u << bit)) specialization.set(bit, VkBool32((features >> bit) & 1));
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = specialization.entries.size();
+    specializationInfo.pMapEntries = specialization.entries.data();
+    specializationInfo.dataSize = specialization.data.size();
+    specializationInfo.pData = specialization.data.data();
+
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages = state.shaderStages;
+
+    for (VkPipelineShaderStageCreateInfo& shaderStage : shaderStages) shaderStage.pSpecializationInfo = &specializationInfo;
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = inputLayout.bindings.size();
-    vertexInputInfo.pVertexBindingDescriptions = inputLayout.bindings.data();
-    vertexInputInfo.vertexAttributeDescriptionCount = inputLayout.attributes.size();
-    vertexInputInfo.pVertexAttributeDescriptions = inputLayout.attributes.data();
+    vertexInputInfo.vertexBindingDescriptionCount = state.bindings.size();
+    vertexInputInfo.pVertexBindingDescriptions = state.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = state.attributes.size();
+    vertexInputInfo.pVertexAttributeDescriptions = state.attributes.data();
 
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = params.primitiveTopology;
+    inputAssembly.topology = state.params.primitiveTopology;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
+    VkPipelineTessellationStateCreateInfo tessellation = {};
+    tessellation.sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO;
+    tessellation.patchControlPoints = state.params.patchControlPoints;
+
     VkViewport viewport = {};
     viewport.x = 0.0f;
     viewport.y = 800.0f;
@@ -95,8 +146,8 @@ void Pipeline::init(VkShaderModule vertShaderModule,
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = params.cullMode;
-    rasterizer.frontFace = params.frontFace;
+    rasterizer.cullMode = state.params.cullMode;
+    rasterizer.frontFace = state.params.frontFace;
     rasterizer.depthBiasEnable = VK_FALSE;
     rasterizer.depthBiasConstantFactor = 0.0f;
     rasterizer.depthBiasClamp = 0.0f;
@@ -112,8 +163,8 @@ void Pipeline::init(VkShaderModule vertShaderModule,
     multisampling.alphaToOneEnable = VK_FALSE;
 
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = params.blend;
+    colorBlendAttachment.colorWriteMask = state.params.colorWriteMask;
+    colorBlendAttachment.blendEnable = state.params.blend;
     colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
     colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
     colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
@@ -136,41 +187,34 @@ void Pipeline::init(VkShaderModule vertShaderModule,
                                                   VK_DYNAMIC_STATE_SCISSOR,
                                                   VK_DYNAMIC_STATE_POLYGON_MODE_EXT };
 
-    if (params.dynamicCullMode) dynamicStates.push_back(VK_DYNAMIC_STATE_CULL_MODE);
+    if (state.params.dynamicCullMode) dynamicStates.push_back(VK_DYNAMIC_STATE_CULL_MODE);
+    if (state.params.dynamicStencilTest) dynamicStates.push_back(VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE);
 
     VkPipelineDynamicStateCreateInfo dynamicState = {};
     dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamicState.dynamicStateCount = dynamicStates.size();
     dynamicState.pDynamicStates = dynamicStates.data();
 
-    createDescriptorSetLayout(bindingLayout);
-
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = bindingLayout.pushranges.size();
-    pipelineLayoutInfo.pPushConstantRanges = bindingLayout.pushranges.data();
-
-    if(vkCreatePipelineLayout(vkInstance.device(), &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to create pipeline layout!");
-    }
-
     VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
     VkFormat depthFormat = VK_FORMAT_D24_UNORM_S8_UINT;
 
     VkPipelineDepthStencilStateCreateInfo depthStencil {};
     depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = params.depthTest;
-    depthStencil.depthWriteEnable = params.depthWrite;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthTestEnable = state.params.depthTest;
+    depthStencil.depthWriteEnable = state.params.depthWrite;
+    depthStencil.depthCompareOp = state.params.depthCompareOp;
     depthStencil.depthBoundsTestEnable = VK_FALSE;
     depthStencil.minDepthBounds = 0.0f;
     depthStencil.maxDepthBounds = 1.0f;
-    depthStencil.stencilTestEnable = VK_FALSE;
-    depthStencil.front = {};
-    depthStencil.back = {};
+    depthStencil.stencilTestEnable = state.params.stencilTest;
+    depthStencil.front.failOp = VK_STENCIL_OP_KEEP;
+    depthStencil.front.passOp = state.params.stencilPassOp;
+    depthStencil.front.depthFailOp = VK_STENCIL_OP_KEEP;
+    depthStencil.front.compareOp = state.params.stencilCompareOp;
+    depthStencil.front.compareMask = 0xff;
+    depthStencil.front.writeMask = 0xff;
+    depthStencil.front.reference = state.params.stencilReference;
+    depthStencil.back = depthStencil.front;
 
     VkPipelineRenderingCreateInfoKHR pipelineRenderingInfo = {};
     pipelineRenderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
@@ -183,31 +227,112 @@ void Pipeline::init(VkShaderModule vertShaderModule,
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.pNext = &pipelineRenderingInfo;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.stageCount = shaderStages.size();
+    pipelineInfo.pStages = shaderStages.data();
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pTessellationState = state.params.patchControlPoints > 0 ? &tessellation : nullptr;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
-    pipelineInfo.layout = m_pipelineLayout;
+    pipelineInfo.layout = state.layout;
     pipelineInfo.renderPass = VK_NULL_HANDLE;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if(vkCreateGraphicsPipelines(vkInstance.device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline) != VK_SUCCESS)
+    VkPipeline graphicsPipeline;
+    if(vkCreateGraphicsPipelines(vkInstance.device(), vkInstance.pipelineCache(), 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
-    vkDestroyShaderModule(vkInstance.device(), fragShaderModule, nullptr);
-    vkDestroyShaderModule(vkInstance.device(), vertShaderModule, nullptr);
-
     std::cout << "Graphics Pipeline created" << std::endl;
+
+    return graphicsPipeline;
+}
+
+void Pipeline::init(const std::vector<VkPipelineShaderStageCreateInfo>& shaderStages,
+                    const InputLayout& inputLayout,
+                    const BindingLayout& bindingLayout,
+                    const PipelineParameters& params)
+{
+    VulkanInstance& vkInstance = VulkanInstance::GetInstance();
+
+    createDescriptorSetLayout(bindingLayout);
+
+    m_textureTable = bindingLayout.textureTable;
+
+    VkDescriptorSetLayout setLayouts[] = { m_descriptorSetLayout, vkInstance.textureTable().layout() };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = m_textureTable ? 2 : 1;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = bindingLayout.pushranges.size();
+    pipelineLayoutInfo.pPushConstantRanges = bindingLayout.pushranges.data();
+
+    if(vkCreatePipelineLayout(vkInstance.device(), &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    if (params.permutations.empty()) throw std::runtime_error("Pipeline: no permutation to compile!");
+
+    // Layouts are needed by descriptor sets right away, permutations are compiled on their own threads
+    m_state = std::make_unique<PipelineState>(PipelineState{ shaderStages, inputLayout.bindings, inputLayout.attributes, params, m_pipelineLayout });
+
+    m_permutations.resize(params.permutations.size());
+    m_errors.resize(params.permutations.size());
+
+    for (size_t i = 0; i < params.permutations.size(); i++)
+    {
+        m_permutations[i] = { params.permutations[i], VK_NULL_HANDLE };
+
+        m_builders.emplace_back([this, i]()
+        {
+            StartupPhase phase("pipeline creation");
+
+            try
+            {
+                m_permutations[i].second = createGraphicsPipeline(*m_state, m_permutations[i].first);
+            }
+            catch (const std::exception& e)
+            {
+                m_errors[i] = e.what();
+            }
+        });
+    }
+}
+
+void Pipeline::wait()
+{
+    for (std::thread& builder : m_builders)
+        if (builder.joinable()) builder.join();
+
+    for (const std::string& error : m_errors)
+        if (!error.empty()) throw std::runtime_error(error);
+
+    m_graphicsPipeline = m_permutations[0].second;
+}
+
+VkPipeline Pipeline::permutation(uint32_t features) const
+{
+    std::lock_guard<std::mutex> lock(m_permutationLock);
+
+    for (const auto& [bits, pipeline] : m_permutations)
+        if (bits == features) return pipeline;
+
+    // Not declared up front, compiled on first use and kept
+    VkPipeline pipeline = createGraphicsPipeline(*m_state, features);
+    m_permutations.push_back({ features, pipeline });
+
+    std::cout << "Pipeline permutation " << features << " compiled on demand" << std::endl;
+
+    return pipeline;
 }
 
 void Pipeline::createDescriptorSetLayout(const BindingLayout& bindingLayout)
@@ -228,11 +353,17 @@ void Pipeline::createDescriptorSetLayout(const BindingLayout& bindingLayout)
 
 Pipeline::~Pipeline()
 {
+    for (std::thread& builder : m_builders)
+        if (builder.joinable()) builder.join();
+
     VulkanInstance& vkInstance = VulkanInstance::GetInstance();
 
     vkDestroyDescriptorSetLayout(vkInstance.device(), m_descriptorSetLayout, nullptr);
     vkDestroyPipelineLayout(vkInstance.device(), m_pipelineLayout, nullptr);
-    vkDestroyPipeline(vkInstance.device(), m_graphicsPipeline, nullptr);
+
+    for (const auto& [bits, pipeline] : m_permutations) vkDestroyPipeline(vkInstance.device(), pipeline, nullptr);
+
+    for (const VkPipelineShaderStageCreateInfo& shaderStage : m_state->shaderStages) vkDestroyShaderModule(vkInstance.device(), shaderStage.module, nullptr);
 }
 
 VkShaderModule Pipeline::loadShader(const char * name)
@@ -2,6 +2,12 @@
 
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <cstring>
 
 namespace Render
 {
@@ -16,6 +22,27 @@ struct BindingLayout
 {
     const std::vector<VkDescriptorSetLayoutBinding> bindings;
     const std::vector<VkPushConstantRange> pushranges;
+    const bool textureTable = false;    // Instance texture table is bound as set 1
+};
+
+// 32 bit scalar specialization constants by constant_id. Ids below 32 are reserved for permutation
+// feature bits: bit i of a permutation specializes bool constant_id i.
+struct Specialization
+{
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint8_t> data;
+
+    template<class T>
+    Specialization& set(uint32_t id, T value)
+    {
+        static_assert(sizeof(T) == 4, "specialization constants are 32 bit scalars");
+
+        entries.push_back({ id, uint32_t(data.size()), sizeof(T) });
+        data.resize(data.size() + sizeof(T));
+        memcpy(data.data() + entries.back().offset, &value, sizeof(T));
+
+        return *this;
+    }
 };
 
 struct PipelineParameters
@@ -27,22 +54,43 @@ struct PipelineParameters
     VkBool32 depthWrite = VK_TRUE;
     VkBool32 blend = VK_FALSE;
     bool dynamicCullMode = false;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+    VkBool32 stencilTest = VK_FALSE;
+    VkCompareOp stencilCompareOp = VK_COMPARE_OP_ALWAYS;
+    VkStencilOp stencilPassOp = VK_STENCIL_OP_KEEP;
+    uint32_t stencilReference = 0;
+    bool dynamicStencilTest = false;
+    VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    uint32_t patchControlPoints = 0;    // Used with tessellation stages and patch list topology
+    Specialization constants;           // Tuning constants shared by every permutation
+    std::vector<uint32_t> permutations = { 0 };    // Feature bit sets compiled up front, first one is default
 };
 
+struct PipelineState;
+
 class Pipeline
 {
 private:
     VkDescriptorSetLayout m_descriptorSetLayout;
     VkPipelineLayout m_pipelineLayout;
-    VkPipeline m_graphicsPipeline;
+    bool m_textureTable = false;
+    VkPipeline m_graphicsPipeline = VK_NULL_HANDLE;       // Default permutation
+
+    // Shader modules and create parameters stay alive, permutations missing in cache are compiled on demand
+    std::unique_ptr<PipelineState> m_state;
+    mutable std::vector<std::pair<uint32_t, VkPipeline>> m_permutations;
+    mutable std::mutex m_permutationLock;
+
+    // One per declared permutation, compiled against instance pipeline cache
+    std::vector<std::thread> m_builders;
+    std::vector<std::string> m_errors;
 
     VkShaderModule loadShader(const char * name);
     VkShaderModule buildShader(const uint8_t* buffer, size_t size);
 
     void createDescriptorSetLayout(const BindingLayout& bindingLayout);
 
-    void init(VkShaderModule vertShaderModule, 
-              VkShaderModule fragShaderModule,
+    void init(const std::vector<VkPipelineShaderStageCreateInfo>& shaderStages,
               const InputLayout& inputLayout,
               const BindingLayout& bindingLayout,
               const PipelineParameters& params);
@@ -59,12 +107,28 @@ public:
              const InputLayout& inputLayout,
              const BindingLayout& bindingLayout,
              const PipelineParameters& params);
+
+    Pipeline(const uint8_t* vertexShader, size_t vertexShaderSize,
+             const uint8_t* tessControlShader, size_t tessControlShaderSize,
+             const uint8_t* tessEvalShader, size_t tessEvalShaderSize,
+             const uint8_t* fragmentShader, size_t fragmentShaderSize,
+             const InputLayout& inputLayout,
+             const BindingLayout& bindingLayout,
+             const PipelineParameters& params);
     ~Pipeline();
 
+    // Blocks until declared permutations are compiled, throws if compilation failed. Pipelines
+    // constructed one after other compile side by side until first of them is waited for.
+    void wait();
+
+    // Pipeline specialized for feature bits, valid after wait
+    VkPipeline permutation(uint32_t features) const;
+
     operator VkPipeline() const { return m_graphicsPipeline; }
 
     VkPipelineLayout pipelineLayout() const { return m_pipelineLayout; }
     VkDescriptorSetLayout descriptorLayout() const { return m_descriptorSetLayout; }
+    bool textureTable() const { return m_textureTable; }
 };
 
 } // namespace Render
@@ -0,0 +1,46 @@
+#include "QueryPool.h"
+#include "Render/Vulkan/VulkanInstance.h"
+
+#include <bit>
+#include <stdexcept>
+
+namespace Render
+{
+
+QueryPool::QueryPool(VkQueryType type, uint32_t count, VkQueryPipelineStatisticFlags statistics)
+: m_type(type)
+, m_count(count)
+, m_valuesPerQuery(type == VK_QUERY_TYPE_PIPELINE_STATISTICS ? std::popcount(statistics) : 1)
+{
+    VulkanInstance& vkInstance = VulkanInstance::GetInstance();
+
+    VkQueryPoolCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    createInfo.queryType = type;
+    createInfo.queryCount = count;
+    createInfo.pipelineStatistics = statistics;
+
+    if (vkCreateQueryPool(vkInstance.device(), &createInfo, nullptr, &m_queryPool) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create query pool!");
+    }
+}
+
+QueryPool::~QueryPool()
+{
+    vkDestroyQueryPool(VulkanInstance::GetInstance().device(), m_queryPool, nullptr);
+}
+
+void QueryPool::results(uint32_t first, uint32_t count, uint64_t* data) const
+{
+    size_t stride = sizeof(uint64_t) * m_valuesPerQuery;
+
+    vkGetQueryPoolResults(VulkanInstance::GetInstance().device(),
+                          m_queryPool,
+                          first, count,
+                          stride * count, data,
+                          stride,
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+}
+
+} // namespace Render
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace Render
+{
+
+class QueryPool
+{
+    VkQueryPool m_queryPool;
+    VkQueryType m_type;
+    uint32_t m_count;
+    uint32_t m_valuesPerQuery;
+
+public:
+    QueryPool(VkQueryType type, uint32_t count, VkQueryPipelineStatisticFlags statistics = 0);
+    ~QueryPool();
+
+    uint32_t count() const { return m_count; }
+
+    // Waits for queries to become available, each query takes valuesPerQuery() entries in data
+    void results(uint32_t first, uint32_t count, uint64_t* data) const;
+
+    uint32_t valuesPerQuery() const { return m_valuesPerQuery; }
+
+    operator VkQueryPool() const { return m_queryPool; }
+};
+
+} // namespace Render
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace Render
+{
+
+// Global bindless set of sampled textures, bound as set 1 of pipelines using it. Shaders index it
+// with slots passed in push constants, slot keeps its index when texture behind it is replaced.
+class TextureTable
+{
+    VkDevice m_device;
+
+    VkDescriptorPool m_descriptorPool;
+    VkDescriptorSetLayout m_layout;
+    VkDescriptorSet m_descriptorSet;
+
+    uint32_t m_slots = 0;
+
+public:
+    static constexpr uint32_t MaxTextures = 1024;      // Slots fit 10 bits of packed push constants
+
+    explicit TextureTable(VkDevice device);
+    ~TextureTable();
+
+    // New empty slot, written by update before first draw reading it
+    uint32_t allocate();
+    void update(uint32_t slot, VkImageView image, VkSampler sampler);
+
+    uint32_t size() const { return m_slots; }
+
+    VkDescriptorSetLayout layout() const { return m_layout; }
+    operator VkDescriptorSet() const { return m_descriptorSet; }
+};
+
+} // namespace Render
@@ -12,6 +12,11 @@
 #include "Resources/Image.h"
 
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <cstdio>
 #include "string.h"
 
 namespace Render
@@ -28,6 +33,12 @@ VulkanInstance::VulkanInstance()
     createInstance();
     selectPhysicalDevice();
     createLogicalDevice();
+    createPipelineCache();
+    detectBlitMipFormats();
+    detectCompressedFormats();
+
+    m_textureTable = std::make_unique<TextureTable>(m_device);
+
     createDescriptorPool();
     createCommandPool(&m_commandPool);
     createCommandList();
@@ -44,6 +55,10 @@ VulkanInstance::~VulkanInstance()
 
     vkDestroyCommandPool(m_device, m_commandPool, nullptr);
     vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    m_textureTable.reset();
+
+    savePipelineCache();
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
 
     vkDestroyDevice(m_device, nullptr);
 
@@ -166,6 +181,11 @@ void VulkanInstance::selectPhysicalDevice()
     }
 
     if(m_physicalDevices.empty()) throw std::runtime_error("failed to find a suitable GPU!");
+
+    // First device is used, discrete GPUs go before integrated and software ones
+    std::stable_sort(m_physicalDevices.begin(), m_physicalDevices.end(), [](const PhysicalDevice& a, const PhysicalDevice& b) { return a.rank() < b.rank(); });
+
+    std::cout << "Selected " << m_physicalDevices[0].properties().deviceName << std::endl;
 }
 
 void VulkanInstance::createLogicalDevice()
@@ -182,8 +202,17 @@ void VulkanInstance::createLogicalDevice()
     vulkan14Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_4_FEATURES;
     vulkan14Features.pushDescriptor = VK_TRUE;
 
+    // Texture table: unbounded sampler array indexed by push constants, slots written while bound
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+    indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
     VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicStateFeatures = {};
     dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+    dynamicStateFeatures.pNext = &indexingFeatures;
     dynamicStateFeatures.extendedDynamicState3PolygonMode = VK_TRUE;
     dynamicStateFeatures.extendedDynamicState3DepthClipEnable = VK_TRUE;
 
@@ -197,6 +226,9 @@ void VulkanInstance::createLogicalDevice()
     deviceFeatures.samplerAnisotropy = VK_TRUE;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
     deviceFeatures.shaderClipDistance = VK_TRUE;
+    deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+    deviceFeatures.tessellationShader = VK_TRUE;
+    deviceFeatures.textureCompressionBC = m_physicalDevices[0].textureCompressionBC();
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -225,6 +257,95 @@ void VulkanInstance::createLogicalDevice()
     vkGetDeviceQueue(m_device, m_physicalDevices[0].graphicsFamilyIndex(), 0, &m_graphicsQueue);
 }
 
+// Cache file starts with identity of device and driver that wrote it. Drivers validate their own blob
+// header too, but some fail on blobs of other driver versions instead of ignoring them.
+struct PipelineCacheHeader
+{
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+};
+
+static PipelineCacheHeader pipelineCacheHeader(const PhysicalDevice& device, uint32_t magic)
+{
+    PipelineCacheHeader header = {};
+    header.magic = magic;
+    header.vendorID = device.properties().vendorID;
+    header.deviceID = device.properties().deviceID;
+    header.driverVersion = device.properties().driverVersion;
+    memcpy(header.driverUUID, device.driverUUID(), VK_UUID_SIZE);
+
+    return header;
+}
+
+void VulkanInstance::createPipelineCache()
+{
+    PipelineCacheHeader expected = pipelineCacheHeader(m_physicalDevices[0], PipelineCacheMagic);
+    PipelineCacheHeader header = {};
+    std::vector<char> data;
+
+    std::ifstream file(PipelineCacheFile, std::ios::binary);
+
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        expected.dataSize = header.dataSize;
+
+        if (memcmp(&header, &expected, sizeof(header)) == 0)
+        {
+            data.resize(header.dataSize);
+
+            if (!file.read(data.data(), data.size())) data.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(m_device, &createInfo, nullptr, &m_pipelineCache) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    if (data.empty())
+        std::cout << "Pipeline cache: cold start, pipelines are compiled from SPIR-V" << std::endl;
+    else
+        std::cout << "Pipeline cache: " << data.size() / 1024 << " KB loaded" << std::endl;
+}
+
+void VulkanInstance::savePipelineCache()
+{
+    size_t dataSize = 0;
+
+    if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) return;
+
+    std::vector<char> data(dataSize);
+
+    if (vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, data.data()) != VK_SUCCESS) return;
+
+    PipelineCacheHeader header = pipelineCacheHeader(m_physicalDevices[0], PipelineCacheMagic);
+    header.dataSize = dataSize;
+
+    // Written aside and renamed, interrupted save never leaves a truncated cache with valid header
+    std::string temp = std::string(PipelineCacheFile) + ".tmp";
+
+    {
+        std::ofstream file(temp, std::ios::binary);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), dataSize);
+
+        if (!file) return;
+    }
+
+    std::remove(PipelineCacheFile);
+    std::rename(temp.c_str(), PipelineCacheFile);
+}
+
 void VulkanInstance::swapChainSupportInfo(VkSurfaceKHR surface)
 {
     m_physicalDevices[0].getSwapChainSupportInfo(surface);
@@ -307,6 +428,103 @@ VkSwapchainKHR VulkanInstance::createSwapChain(VkSurfaceKHR surface, VkExtent2D&
 }
 
 void VulkanInstance::createTexture(Buffer& buffer, Image& image)
+{
+    createTextureImage(image);
+
+    waitIdle();
+
+    m_commandList.begin();
+    m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    m_commandList.copyBufferToImage(buffer, image.image, image.width, image.height, image.mipmaps, image.format);
+    m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    m_commandList.finish();
+
+    submit(m_commandList);
+    waitIdle();
+
+    createTextureView(image);
+}
+
+void VulkanInstance::createTextures(Buffer& buffer, const std::vector<TextureUpload>& uploads)
+{
+    for (const TextureUpload& upload : uploads)
+        createTextureImage(*upload.image, upload.texture->generateMips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+
+    waitIdle();
+
+    m_commandList.begin();
+
+    for (const TextureUpload& upload : uploads)
+    {
+        Image& image = *upload.image;
+
+        std::vector<VkBufferImageCopy> regions = upload.texture->regions;
+        for (VkBufferImageCopy& region : regions) region.bufferOffset += upload.offset;
+
+        m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        m_commandList.copyBufferToImage(buffer, image.image, regions);
+
+        if (upload.texture->generateMips)
+            m_commandList.generateMipmaps(image.image, image.width, image.height, image.mipmaps);
+        else
+            m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    m_commandList.finish();
+
+    submit(m_commandList);
+    waitIdle();
+
+    for (const TextureUpload& upload : uploads) createTextureView(*upload.image);
+}
+
+void VulkanInstance::detectBlitMipFormats()
+{
+    const VkFormat formats[] = { VK_FORMAT_R8_UNORM, VK_FORMAT_R16_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8_SNORM, VK_FORMAT_R16G16_SNORM };
+
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    for (VkFormat format : formats)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(m_physicalDevices[0], format, &properties);
+
+        if ((properties.optimalTilingFeatures & required) == required) m_blitMipFormats.push_back(format);
+    }
+
+    std::cout << "GPU mip generation formats: " << m_blitMipFormats.size() << " of " << std::size(formats) << std::endl;
+}
+
+bool VulkanInstance::blitMipmaps(VkFormat format) const
+{
+    return std::find(m_blitMipFormats.begin(), m_blitMipFormats.end(), format) != m_blitMipFormats.end();
+}
+
+void VulkanInstance::detectCompressedFormats()
+{
+    const VkFormat formats[] = { VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK };
+
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    // Formats can't be used unless the feature is enabled, whatever their properties report
+    for (VkFormat format : formats)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(m_physicalDevices[0], format, &properties);
+
+        if (m_physicalDevices[0].textureCompressionBC() && (properties.optimalTilingFeatures & required) == required)
+            m_compressedFormats.push_back(format);
+    }
+
+    std::cout << "Block-compressed formats: " << m_compressedFormats.size() << " of " << std::size(formats) << std::endl;
+}
+
+bool VulkanInstance::compressedFormat(VkFormat format) const
+{
+    return std::find(m_compressedFormats.begin(), m_compressedFormats.end(), format) != m_compressedFormats.end();
+}
+
+void VulkanInstance::createTextureImage(Image& image, VkImageUsageFlags usage)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -319,7 +537,7 @@ void VulkanInstance::createTexture(Buffer& buffer, Image& image)
     imageInfo.format = image.format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | usage;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.flags = 0;
@@ -343,19 +561,10 @@ void VulkanInstance::createTexture(Buffer& buffer, Image& image)
     }
 
     vkBindImageMemory(m_device, image.image, image.imageMemory, 0);
+}
 
-    waitIdle();
-
-    m_commandList.begin();
-    m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    m_commandList.copyBufferToImage(buffer, image.image, image.width, image.height, image.mipmaps);
-    m_commandList.barrier(image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    m_commandList.finish();
-
-    submit(m_commandList);
-    waitIdle();
-
-    // ImageView
+void VulkanInstance::createTextureView(Image& image)
+{
     VkImageViewCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     createInfo.image = image.image;
@@ -430,16 +639,16 @@ void VulkanInstance::createDescriptorPool()
 {
     VkDescriptorPoolSize poolSize[2];
     poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize[0].descriptorCount = 16;
+    poolSize[0].descriptorCount = 64;
     poolSize[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSize[1].descriptorCount = 16;
+    poolSize[1].descriptorCount = 256;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = 2;
     poolInfo.pPoolSizes = poolSize;
     poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-    poolInfo.maxSets = 16;
+    poolInfo.maxSets = 64;
 
     if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool) != VK_SUCCESS)
     {
@@ -7,6 +7,7 @@
 
 #include "Render/Vulkan/PhysicalDevice.h"
 #include "Render/Vulkan/CommandList.h"
+#include "Render/Vulkan/TextureTable.h"
 
 #ifdef NDEBUG
     #define ENABLE_VALIDATION_LAYERS false
@@ -15,12 +16,20 @@
 #endif
 
 struct Image;
+struct TextureData;
 
 namespace Render
 {
 
 class Buffer;
 
+struct TextureUpload
+{
+    Image* image;
+    const TextureData* texture;
+    VkDeviceSize offset;            // Start of texture data in staging buffer
+};
+
 class VulkanInstance
 {
     static const std::vector<const char*> ValidationLayers;
@@ -37,12 +46,22 @@ private:
     VkQueue m_presentQueue = VK_NULL_HANDLE;
 
     VkDescriptorPool m_descriptorPool;
+    std::unique_ptr<TextureTable> m_textureTable;
+
+    // Compiled pipelines of previous runs, file is dropped when it was written by other device or driver
+    VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+
+    static constexpr const char* PipelineCacheFile = "pipeline.cache";
+    static constexpr uint32_t PipelineCacheMagic = 0x48435050;    // "PPCH"
 
     VkCommandPool m_commandPool;
     CommandList m_commandList = VK_NULL_HANDLE;
 
     std::vector<const char*> m_validationLayers;
 
+    std::vector<VkFormat> m_blitMipFormats;
+    std::vector<VkFormat> m_compressedFormats;
+
     std::vector<const char*> enumerateSupportedValidationLayers();
     std::vector<const char*> enumerateExtensions();
 
@@ -50,9 +69,17 @@ private:
     void selectPhysicalDevice();
     void createLogicalDevice();
     void createDescriptorPool();
+    void createPipelineCache();
+    void savePipelineCache();
     void createCommandPool(VkCommandPool* commandPool);
     void createCommandList();
 
+    void detectBlitMipFormats();
+    void detectCompressedFormats();
+
+    void createTextureImage(Image& image, VkImageUsageFlags usage = 0);
+    void createTextureView(Image& image);
+
 public:
     static VulkanInstance& GetInstance();
 
@@ -60,18 +87,30 @@ public:
 
     void submit(VkCommandBuffer commandBuffer);
 
+    float timestampPeriod() { return m_physicalDevices[0].timestampPeriod(); }
+
     uint32_t detectMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
     void swapChainSupportInfo(VkSurfaceKHR surface);
 
     VkSwapchainKHR createSwapChain(VkSurfaceKHR surface, VkExtent2D& imageExtent);
     void createTexture(Buffer& buffer, Image& image);
+    // Textures share one staging buffer and one submit, levels are copied by texture regions
+    // and chains of textures holding first level only are blitted on GPU
+    void createTextures(Buffer& buffer, const std::vector<TextureUpload>& uploads);
+
+    // Formats with linear blit support build mip chains on GPU, others on CPU
+    bool blitMipmaps(VkFormat format) const;
+    // Block-compressed formats the device samples, textures in other ones are kept or expanded to RGBA8
+    bool compressedFormat(VkFormat format) const;
     void createBuffer(Buffer& buffer, const void* data, size_t size);
 
     void transitImageState(std::vector<VkImage>& images, VkImageLayout oldLayout, VkImageLayout newLayout);
     void transitImageState(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
 
     VkDescriptorPool descriptorPool() { return m_descriptorPool; }
+    VkPipelineCache pipelineCache() { return m_pipelineCache; }
+    TextureTable& textureTable() { return *m_textureTable; }
     VkQueue presentQueue() { return m_presentQueue; }
 
     void waitIdle();
@@ -0,0 +1,292 @@
+#include "BlockCompress.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <cfloat>
+
+static uint16_t pack565(const glm::vec3& color)
+{
+    glm::uvec3 c = glm::uvec3(glm::clamp(color, 0.0f, 255.0f) * glm::vec3(31.0f, 63.0f, 31.0f) / 255.0f + 0.5f);
+
+    return uint16_t(c.r << 11 | c.g << 5 | c.b);
+}
+
+static glm::vec3 unpack565(uint16_t color)
+{
+    uint32_t r = color >> 11 & 31;
+    uint32_t g = color >> 5 & 63;
+    uint32_t b = color & 31;
+
+    return glm::vec3(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+}
+
+// Endpoints are extremes of texels projected on principal axis of block colors
+static void encodeColor(const uint8_t* texels, uint8_t* block)
+{
+    glm::vec3 colors[16];
+    glm::vec3 mean(0.0f);
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        colors[i] = glm::vec3(texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2]);
+        mean += colors[i];
+    }
+
+    mean /= 16.0f;
+
+    glm::mat3 covariance(0.0f);
+
+    for (const glm::vec3& color : colors)
+    {
+        glm::vec3 d = color - mean;
+        covariance += glm::outerProduct(d, d);
+    }
+
+    // Power iteration converges to dominant eigenvector, flat blocks keep luminance axis
+    glm::vec3 axis(1.0f);
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        glm::vec3 next = covariance * axis;
+        float length = glm::length(next);
+
+        if (length < 1e-6f) break;
+
+        axis = next / length;
+    }
+
+    axis = glm::normalize(axis);
+
+    float tmin = 0.0f;
+    float tmax = 0.0f;
+
+    for (const glm::vec3& color : colors)
+    {
+        float t = glm::dot(color - mean, axis);
+
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+
+    uint16_t c0 = pack565(mean + axis * tmax);
+    uint16_t c1 = pack565(mean + axis * tmin);
+
+    // Four color mode requires first endpoint greater
+    if (c0 < c1) std::swap(c0, c1);
+
+    glm::vec3 palette[4];
+    palette[0] = unpack565(c0);
+    palette[1] = unpack565(c1);
+    palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+    palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+
+    uint32_t indices = 0;
+
+    for (uint32_t i = 0; c0 != c1 && i < 16; i++)
+    {
+        uint32_t best = 0;
+        float bestDist = FLT_MAX;
+
+        for (uint32_t k = 0; k < 4; k++)
+        {
+            glm::vec3 d = colors[i] - palette[k];
+            float dist = glm::dot(d, d);
+
+            if (dist < bestDist)
+            {
+                best = k;
+                bestDist = dist;
+            }
+        }
+
+        indices |= best << (i * 2);
+    }
+
+    block[0] = uint8_t(c0);
+    block[1] = uint8_t(c0 >> 8);
+    block[2] = uint8_t(c1);
+    block[3] = uint8_t(c1 >> 8);
+
+    for (uint32_t i = 0; i < 4; i++) block[4 + i] = uint8_t(indices >> (i * 8));
+}
+
+// Single channel block with eight interpolated values between channel extremes
+static void encodeChannel(const uint8_t* texels, uint32_t channel, uint8_t* block)
+{
+    uint8_t lo = 255;
+    uint8_t hi = 0;
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        lo = std::min(lo, texels[i * 4 + channel]);
+        hi = std::max(hi, texels[i * 4 + channel]);
+    }
+
+    block[0] = hi;
+    block[1] = lo;
+
+    uint64_t indices = 0;
+
+    for (uint32_t i = 0; hi > lo && i < 16; i++)
+    {
+        // Weight of first endpoint in sevenths, palette order is hi, lo, then 6/7 hi down to 1/7 hi
+        uint32_t weight = ((texels[i * 4 + channel] - lo) * 14 + (hi - lo)) / ((hi - lo) * 2);
+        uint64_t index = weight == 7 ? 0 : weight == 0 ? 1 : 8 - weight;
+
+        indices |= index << (i * 3);
+    }
+
+    for (uint32_t i = 0; i < 6; i++) block[2 + i] = uint8_t(indices >> (i * 8));
+}
+
+void EncodeBC1(const uint8_t* texels, uint8_t* block)
+{
+    encodeColor(texels, block);
+}
+
+void EncodeBC3(const uint8_t* texels, uint8_t* block)
+{
+    encodeChannel(texels, 3, block);
+    encodeColor(texels, block + 8);
+}
+
+void EncodeBC5(const uint8_t* texels, uint8_t* block)
+{
+    encodeChannel(texels, 0, block);
+    encodeChannel(texels, 1, block + 8);
+}
+
+std::vector<uint8_t> CompressLevel(const uint8_t* data, uint32_t width, uint32_t height, VkFormat format)
+{
+    void (*encode)(const uint8_t* texels, uint8_t* block) = nullptr;
+
+    switch (format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: encode = EncodeBC1; break;
+    case VK_FORMAT_BC3_UNORM_BLOCK: encode = EncodeBC3; break;
+    case VK_FORMAT_BC5_UNORM_BLOCK: encode = EncodeBC5; break;
+    default: throw std::runtime_error("CompressLevel: unsupported format!");
+    }
+
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+    size_t blockBytes = blocksize(format);
+
+    std::vector<uint8_t> blocks(levelsize(format, width, height));
+
+    uint8_t texels[16 * 4];
+
+    for (uint32_t by = 0; by < blocksY; by++)
+        for (uint32_t bx = 0; bx < blocksX; bx++)
+        {
+            for (uint32_t k = 0; k < 4; k++)
+                for (uint32_t i = 0; i < 4; i++)
+                {
+                    uint32_t x = std::min(bx * 4 + i, width - 1);
+                    uint32_t y = std::min(by * 4 + k, height - 1);
+
+                    const uint8_t* texel = data + (size_t(y) * width + x) * 4;
+                    std::copy(texel, texel + 4, texels + (k * 4 + i) * 4);
+                }
+
+            encode(texels, blocks.data() + (size_t(by) * blocksX + bx) * blockBytes);
+        }
+
+    return blocks;
+}
+
+// Four color palette of encodeColor, three colors and black when first endpoint is not greater
+static void decodeColor(const uint8_t* block, uint8_t* texels)
+{
+    uint16_t c0 = uint16_t(block[0] | block[1] << 8);
+    uint16_t c1 = uint16_t(block[2] | block[3] << 8);
+
+    glm::vec3 palette[4];
+    palette[0] = unpack565(c0);
+    palette[1] = unpack565(c1);
+
+    if (c0 > c1)
+    {
+        palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+    }
+    else
+    {
+        palette[2] = (palette[0] + palette[1]) / 2.0f;
+        palette[3] = glm::vec3(0.0f);
+    }
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | uint32_t(block[7]) << 24;
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        const glm::vec3& color = palette[indices >> (i * 2) & 3];
+
+        texels[i * 4] = uint8_t(color.r + 0.5f);
+        texels[i * 4 + 1] = uint8_t(color.g + 0.5f);
+        texels[i * 4 + 2] = uint8_t(color.b + 0.5f);
+    }
+}
+
+// Palette of encodeChannel, six values with 0 and 255 when first endpoint is not greater
+static void decodeChannel(const uint8_t* block, uint32_t channel, uint8_t* texels)
+{
+    uint32_t hi = block[0];
+    uint32_t lo = block[1];
+
+    uint8_t palette[8] = { uint8_t(hi), uint8_t(lo), 0, 0, 0, 0, 0, 255 };
+
+    for (uint32_t k = 2; k < 8; k++)
+    {
+        if (hi > lo) palette[k] = uint8_t(((8 - k) * hi + (k - 1) * lo + 3) / 7);
+        else if (k < 6) palette[k] = uint8_t(((6 - k) * hi + (k - 1) * lo + 2) / 5);
+    }
+
+    uint64_t indices = 0;
+
+    for (uint32_t i = 0; i < 6; i++) indices |= uint64_t(block[2 + i]) << (i * 8);
+
+    for (uint32_t i = 0; i < 16; i++) texels[i * 4 + channel] = palette[indices >> (i * 3) & 7];
+}
+
+std::vector<uint8_t> DecompressLevel(const uint8_t* blocks, uint32_t width, uint32_t height, VkFormat format)
+{
+    if (format != VK_FORMAT_BC1_RGB_UNORM_BLOCK && format != VK_FORMAT_BC3_UNORM_BLOCK && format != VK_FORMAT_BC5_UNORM_BLOCK)
+        throw std::runtime_error("DecompressLevel: unsupported format!");
+
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+    size_t blockBytes = blocksize(format);
+
+    std::vector<uint8_t> data(size_t(width) * height * 4);
+
+    uint8_t texels[16 * 4];
+
+    for (uint32_t by = 0; by < blocksY; by++)
+        for (uint32_t bx = 0; bx < blocksX; bx++)
+        {
+            const uint8_t* block = blocks + (size_t(by) * blocksX + bx) * blockBytes;
+
+            std::fill(std::begin(texels), std::end(texels), uint8_t(0));
+            for (uint32_t i = 0; i < 16; i++) texels[i * 4 + 3] = 255;
+
+            switch (format)
+            {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK: decodeColor(block, texels); break;
+            case VK_FORMAT_BC3_UNORM_BLOCK: decodeChannel(block, 3, texels); decodeColor(block + 8, texels); break;
+            default: decodeChannel(block, 0, texels); decodeChannel(block + 8, 1, texels); break;
+            }
+
+            // Texels of partial blocks past the edges are dropped
+            for (uint32_t k = 0; k < 4 && by * 4 + k < height; k++)
+                for (uint32_t i = 0; i < 4 && bx * 4 + i < width; i++)
+                {
+                    const uint8_t* texel = texels + (k * 4 + i) * 4;
+                    std::copy(texel, texel + 4, data.data() + (size_t(by * 4 + k) * width + bx * 4 + i) * 4);
+                }
+        }
+
+    return data;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Image.h"
+
+#include <vector>
+#include <cstdint>
+
+// 4x4 block encoders, source block is 16 RGBA8 texels in row order
+void EncodeBC1(const uint8_t* texels, uint8_t* block);     // RGB, 8 bytes
+void EncodeBC3(const uint8_t* texels, uint8_t* block);     // RGBA, 16 bytes
+void EncodeBC5(const uint8_t* texels, uint8_t* block);     // RG, 16 bytes
+
+// Compresses RGBA8 level to BC1, BC3 or BC5, partial blocks at edges repeat last texel
+std::vector<uint8_t> CompressLevel(const uint8_t* data, uint32_t width, uint32_t height, VkFormat format);
+
+// Expands BC1, BC3 or BC5 level to RGBA8 for devices that can't sample it, missing channels are 0 and alpha 255
+std::vector<uint8_t> DecompressLevel(const uint8_t* blocks, uint32_t width, uint32_t height, VkFormat format);
@@ -1,20 +1,32 @@
 #include "Image.h"
 #include "Render/Vulkan/VulkanInstance.h"
+#include "Render/Vulkan/Buffer.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 Image::~Image()
 {
+    destroyTexture();
+
+    if (data) delete[] data;
+}
+
+void Image::destroyTexture()
+{
+    // CPU only images, like the ones of terrain-cook, never touch the device
+    if (image == VK_NULL_HANDLE) return;
+
     Render::VulkanInstance& vkInstance = Render::VulkanInstance::GetInstance();
 
-    if (image != VK_NULL_HANDLE)
-    {
-        vkDestroyImageView(vkInstance.device(), imageView, nullptr);
-        vkDestroyImage(vkInstance.device(), image, nullptr);
-        vkFreeMemory(vkInstance.device(), imageMemory, nullptr);
-    }
+    vkDestroyImageView(vkInstance.device(), imageView, nullptr);
+    vkDestroyImage(vkInstance.device(), image, nullptr);
+    vkFreeMemory(vkInstance.device(), imageMemory, nullptr);
 
-    if (data) delete[] data;
+    imageView = VK_NULL_HANDLE;
+    image = VK_NULL_HANDLE;
+    imageMemory = VK_NULL_HANDLE;
 }
 
 size_t pixelsize(VkFormat format)
@@ -24,114 +36,135 @@ size_t pixelsize(VkFormat format)
     case VK_FORMAT_R8G8B8A8_UNORM: return sizeof(uint32_t);
     case VK_FORMAT_R8_UNORM: return sizeof(uint8_t);
     case VK_FORMAT_R16_UNORM: return sizeof(uint16_t);
+    case VK_FORMAT_R8G8_SNORM: return sizeof(uint16_t);
+    case VK_FORMAT_R16G16_SNORM: return sizeof(uint32_t);
     }
 
     return 1;
 }
 
-size_t Image::size()
+uint32_t blockdim(VkFormat format)
 {
-    size_t imgsize = width * height * pixelsize(format);
-    size_t memsize = imgsize * (1 - pow(0.25f, mipmaps)) / (1 - 0.25f);
+    switch (format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK: return 4;
+    }
 
-    return memsize;
+    return 1;
 }
 
-void downsample_rgba(uint8_t* in, uint8_t* out, int width, int height)
+size_t blocksize(VkFormat format)
 {
-    auto in_pixel = [in, width, height](int x, int y) -> uint8_t*
+    switch (format)
     {
-        return in + (y * width + x) * 4;
-    };
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return 8;
+    case VK_FORMAT_BC3_UNORM_BLOCK: return 16;
+    case VK_FORMAT_BC5_UNORM_BLOCK: return 16;
+    }
 
-    auto out_pixel = [out, width = width / 2, height = height / 2](int x, int y) -> uint8_t*
-    {
-        return out + (y * width + x) * 4;
-    };
+    return pixelsize(format);
+}
 
-    for (int y = 0; y < height / 2; y++)
-    {
-        for (int x = 0; x < width / 2; x++)
-        {
-            float r = in_pixel(x * 2, y * 2)[0] + in_pixel(x * 2 + 1, y * 2)[0] +
-                in_pixel(x * 2, y * 2 + 1)[0] + in_pixel(x * 2 + 1, y * 2 + 1)[0];
+size_t levelsize(VkFormat format, uint32_t width, uint32_t height)
+{
+    uint32_t dim = blockdim(format);
+
+    return size_t((width + dim - 1) / dim) * ((height + dim - 1) / dim) * blocksize(format);
+}
 
-            float g = in_pixel(x * 2, y * 2)[1] + in_pixel(x * 2 + 1, y * 2)[1] +
-                in_pixel(x * 2, y * 2 + 1)[1] + in_pixel(x * 2 + 1, y * 2 + 1)[1];
+size_t Image::size()
+{
+    size_t memsize = 0;
 
-            float b = in_pixel(x * 2, y * 2)[2] + in_pixel(x * 2 + 1, y * 2)[2] +
-                in_pixel(x * 2, y * 2 + 1)[2] + in_pixel(x * 2 + 1, y * 2 + 1)[2];
+    uint32_t w = width;
+    uint32_t h = height;
 
-            float a = in_pixel(x * 2, y * 2)[3] + in_pixel(x * 2 + 1, y * 2)[3] +
-                in_pixel(x * 2, y * 2 + 1)[3] + in_pixel(x * 2 + 1, y * 2 + 1)[3];
+    for (size_t i = 0; i < mipmaps; i++)
+    {
+        memsize += levelsize(format, w, h);
 
-            out_pixel(x, y)[0] = r * 0.25;
-            out_pixel(x, y)[1] = g * 0.25;
-            out_pixel(x, y)[2] = b * 0.25;
-            out_pixel(x, y)[3] = a * 0.25;
-        }
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
     }
+
+    return memsize;
 }
 
-template <class T>
-void downsample(T* in, T* out, int width, int height)
+std::vector<VkBufferImageCopy> LevelRegions(const Image& image, size_t levels)
 {
-    auto in_pixel = [in, width, height](int x, int y) -> T&
-    {
-        return *(in + (y * width + x) * 4);
-    };
+    std::vector<VkBufferImageCopy> regions(levels);
 
-    auto out_pixel = [out, width = width / 2, height = height / 2](int x, int y) -> T&
-    {
-        return *(out + (y * width + x) * 4);
-    };
+    uint32_t w = image.width;
+    uint32_t h = image.height;
+    VkDeviceSize offset = 0;
 
-    for (int y = 0; y < height / 2; y++)
+    for (size_t i = 0; i < levels; i++)
     {
-        for (int x = 0; x < width / 2; x++)
-        {
-            float pixel = in_pixel(x * 2, y * 2) + in_pixel(x * 2 + 1, y * 2) +
-                          in_pixel(x * 2, y * 2 + 1) + in_pixel(x * 2 + 1, y * 2 + 1);
-
-            out_pixel(x, y) = pixel * 0.25f;
-        }
+        regions[i] = {};
+        regions[i].bufferOffset = offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = uint32_t(i);
+        regions[i].imageSubresource.baseArrayLayer = 0;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = { 0, 0, 0 };
+        regions[i].imageExtent = { w, h, 1 };
+
+        offset += levelsize(image.format, w, h);
+
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
     }
-}
 
-template void downsample<uint8_t>(uint8_t* in, uint8_t* out, int width, int height);
-template void downsample<uint16_t>(uint16_t* in, uint16_t* out, int width, int height);
+    return regions;
+}
 
-void BuildMipmaps(uint8_t* data, uint32_t width, uint32_t height, VkFormat format, size_t mipmaps)
+void UploadTextures(const std::vector<std::pair<Image*, const TextureData*>>& textures)
 {
-    size_t pixelsz = pixelsize(format);
+    // Offsets of textures in staging buffer satisfy copy alignment of every format
+    constexpr VkDeviceSize Alignment = 16;
 
-    void (*downsample_func)(uint8_t* in, uint8_t* out, int width, int height);
+    std::vector<Render::TextureUpload> uploads;
+    VkDeviceSize dataSize = 0;
 
-    switch (format)
+    for (const auto& [image, texture] : textures)
     {
-    case VK_FORMAT_R8G8B8A8_UNORM: downsample_func = downsample_rgba;
-    case VK_FORMAT_R8_UNORM: downsample<uint8_t>;
-    case VK_FORMAT_R16_UNORM: downsample<uint16_t>;
+        uploads.push_back({ image, texture, dataSize });
+        dataSize = (dataSize + texture->data.size() + Alignment - 1) & ~(Alignment - 1);
     }
 
-    uint8_t* in = data;
-    uint8_t* out;
+    if (uploads.empty()) return;
 
-    for (size_t i = 0; i < mipmaps - 1; i++)
-    {
-        size_t offset = width * height * pixelsz;
-        out = in + offset;
+    Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, dataSize);
+    uint8_t* data = reinterpret_cast<uint8_t*>(buffer.map(dataSize));
 
-        downsample_func(in, out, width, height);
+    for (const Render::TextureUpload& upload : uploads)
+        memcpy(data + upload.offset, upload.texture->data.data(), upload.texture->data.size());
 
-        in = out;
+    buffer.unmap();
 
-        width /= 2;
-        height /= 2;
-    }
+    Render::VulkanInstance::GetInstance().createTextures(buffer, uploads);
 }
 
-Image* LoadImage(const char* filename)
+Image* CreateSolidTexture(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    Image* image = new Image();
+    image->format = VK_FORMAT_R8G8B8A8_UNORM;
+    image->width = 1;
+    image->height = 1;
+    image->mipmaps = 1;
+
+    TextureData texture;
+    texture.data = { r, g, b, a };
+    texture.regions = LevelRegions(*image, 1);
+
+    UploadTextures({ { image, &texture } });
+
+    return image;
+}
+
+Image* LoadImage(const char* filename, VkFormat format)
 {
     const char* extension = strrchr(filename, '.');
 
@@ -143,8 +176,13 @@ Image* LoadImage(const char* filename)
 
     extension++;
 
+    if (strcmp(extension, "tex") == 0) return LoadTEX(filename);
+
+    // Cooked assets come with mip chain and GPU format, source is decoded only when nothing is cooked
+    if (Image* cooked = LoadCooked(filename)) return cooked;
+
     if (strcmp(extension, "bmp") == 0) return LoadBMP(filename);
-    if (strcmp(extension, "png") == 0) return LoadPNG(filename);
+    if (strcmp(extension, "png") == 0) return LoadPNG(filename, true, false, format);
 
     std::cout << "Unknown image type: " << filename << std::endl;
 
@@ -2,6 +2,10 @@
 
 #include <vulkan/vulkan.h>
 
+#include <vector>
+#include <utility>
+#include <cstdint>
+
 struct Image
 {
     uint32_t width;
@@ -18,6 +22,9 @@ struct Image
 
     size_t size();
 
+    // Releases GPU texture, CPU data is kept
+    void destroyTexture();
+
     Image() = default;
     ~Image();
 
@@ -26,8 +33,56 @@ struct Image
 
 size_t pixelsize(VkFormat format);
 
-void BuildMipmaps(uint8_t* data, uint32_t width, uint32_t height, VkFormat format, size_t mipmaps);
+// Texel block of format, 1x1 for uncompressed formats
+uint32_t blockdim(VkFormat format);
+// Bytes of texel block, pixel size for uncompressed formats
+size_t blocksize(VkFormat format);
+// Bytes of level, partial blocks at edges take whole block
+size_t levelsize(VkFormat format, uint32_t width, uint32_t height);
+
+// Texture levels prepared on CPU, region offsets address data
+struct TextureData
+{
+    std::vector<uint8_t> data;
+    std::vector<VkBufferImageCopy> regions;
+    bool generateMips = false;      // Data holds first level, chain is blitted on GPU
+};
+
+// Copy regions of first levels packed one after another from offset 0
+std::vector<VkBufferImageCopy> LevelRegions(const Image& image, size_t levels);
+
+// Creates GPU textures of prepared images through one staging buffer and one submit
+void UploadTextures(const std::vector<std::pair<Image*, const TextureData*>>& textures);
+
+// 1x1 RGBA8 texture of constant color, stands in for textures still loading
+Image* CreateSolidTexture(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+enum class MipFilter
+{
+    Box,        // 2x2 average
+    Kaiser      // Kaiser windowed sinc, sharper distant detail at few times the cost
+};
+
+// Levels follow first level in data, each one built from previous level in parallel over rows.
+// With srgb set RGB channels of RGBA8 are filtered in linear light, alpha and other formats are linear.
+void BuildMipmaps(uint8_t* data, uint32_t width, uint32_t height, VkFormat format, size_t mipmaps, MipFilter filter = MipFilter::Box, bool srgb = false);
 
 Image* LoadBMP(const char* filename);
-Image* LoadPNG(const char* filename, bool mipmaps = true, bool rawdata = false);
-Image* LoadImage(const char* filename);
\ No newline at end of file
+// Block-compressed format compresses RGBA source after mip chain is built, cooked assets keep their format
+Image* LoadPNG(const char* filename, bool mipmaps = true, bool rawdata = false, VkFormat format = VK_FORMAT_UNDEFINED);
+Image* LoadTEX(const char* filename, bool rawdata = false);
+Image* LoadImage(const char* filename, VkFormat format = VK_FORMAT_UNDEFINED);
+
+// First level in CPU memory, no GPU texture
+Image* DecodePNG(const char* filename);
+bool DecodePNG(const char* filename, Image& image);
+
+// Levels of decoded image in upload layout, image takes final format and mip count.
+// With srgb set color levels are filtered in linear light on CPU, GPU blit would filter encoded values.
+// Neither touches the GPU, both are safe on worker threads.
+void PreparePNG(Image& image, bool mipmaps, VkFormat format, TextureData& texture, bool srgb = false);
+// Cooked container from level firstMip on, coarser levels only
+bool ReadTEX(const char* filename, Image& image, TextureData& texture, uint32_t firstMip = 0);
+
+// Cooked counterpart of source asset if terrain-cook produced one, nullptr otherwise
+Image* LoadCooked(const char* filename, bool rawdata = false);
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "Image.h"
+#include "Parallel.h"
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define MIPMAPS_SSE2
+#endif
+
+namespace
+{
+    constexpr float Pi = 3.14159265358979f;
+
+    // Transfer tables: 8 bit encoded to linear, 16 bit linear back to 8 bit encoded
+    struct SrgbTables
+    {
+        std::array<float, 256> toLinear;
+        std::vector<uint8_t> fromLinear;
+
+        SrgbTables()
+        : fromLinear(65536)
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+            }
+
+            for (uint32_t i = 0; i < 65536; i++)
+            {
+                float l = i / 65535.0f;
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+                fromLinear[i] = uint8_t(c * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    const SrgbTables& srgbTables()
+    {
+        static SrgbTables tables;
+        return tables;
+    }
+
+    float besselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+
+        for (uint32_t k = 1; k < 16; k++)
+        {
+            term *= (x * 0.5f / k) * (x * 0.5f / k);
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    // 2:1 reduction kernels, tap k reads source texel 2x + k - (taps / 2 - 1)
+    struct Kernel
+    {
+        uint32_t taps;
+        std::array<float, 6> weights;
+    };
+
+    const Kernel BoxKernel = { 2, { 0.5f, 0.5f } };
+
+    // Sinc of output texel frequency under Kaiser window of radius 3 source texels, alpha 4
+    const Kernel& kaiserKernel()
+    {
+        static const Kernel kernel = []
+        {
+            constexpr float Alpha = 4.0f;
+            constexpr float Radius = 3.0f;
+
+            Kernel k = { 6 };
+            float sum = 0.0f;
+
+            for (uint32_t i = 0; i < k.taps; i++)
+            {
+                float d = i - 2.5f;
+                float x = Pi * d * 0.5f;
+                float t = d / Radius;
+
+                k.weights[i] = sinf(x) / x * besselI0(Alpha * sqrtf(1.0f - t * t)) / besselI0(Alpha);
+                sum += k.weights[i];
+            }
+
+            for (uint32_t i = 0; i < k.taps; i++) k.weights[i] /= sum;
+
+            return k;
+        }();
+
+        return kernel;
+    }
+
+    // Exact integer 2x2 average with rounding, footprint clamped at odd edges, linear data only
+    template<class T, uint32_t Channels>
+    void boxRow(const T* in, uint32_t inWidth, uint32_t inHeight, T* out, uint32_t outWidth, uint32_t y, uint32_t first)
+    {
+        const T* row0 = in + size_t(std::min(y * 2, inHeight - 1)) * inWidth * Channels;
+        const T* row1 = in + size_t(std::min(y * 2 + 1, inHeight - 1)) * inWidth * Channels;
+
+        T* dst = out + size_t(y) * outWidth * Channels;
+
+        for (uint32_t x = first; x < outWidth; x++)
+        {
+            uint32_t x0 = std::min(x * 2, inWidth - 1) * Channels;
+            uint32_t x1 = std::min(x * 2 + 1, inWidth - 1) * Channels;
+
+            for (uint32_t c = 0; c < Channels; c++)
+            {
+                uint32_t sum = uint32_t(row0[x0 + c]) + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                dst[x * Channels + c] = T((sum + 2) / 4);
+            }
+        }
+    }
+
+    template<class T, uint32_t Channels>
+    void boxLevel(const T* in, uint32_t inWidth, uint32_t inHeight, T* out, uint32_t outWidth, uint32_t outHeight)
+    {
+        ParallelFor(0, outHeight, [&](uint32_t y)
+        {
+            boxRow<T, Channels>(in, inWidth, inHeight, out, outWidth, y, 0);
+        });
+    }
+
+#ifdef MIPMAPS_SSE2
+    // Four RGBA8 texels per iteration: rows summed in 16 bit lanes, pairs folded, rounded and packed back
+    template<>
+    void boxLevel<uint8_t, 4>(const uint8_t* in, uint32_t inWidth, uint32_t inHeight, uint8_t* out, uint32_t outWidth, uint32_t outHeight)
+    {
+        ParallelFor(0, outHeight, [&](uint32_t y)
+        {
+            const uint8_t* row0 = in + size_t(std::min(y * 2, inHeight - 1)) * inWidth * 4;
+            const uint8_t* row1 = in + size_t(std::min(y * 2 + 1, inHeight - 1)) * inWidth * 4;
+
+            uint8_t* dst = out + size_t(y) * outWidth * 4;
+
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i round = _mm_set1_epi16(2);
+
+            auto fold = [&](__m128i a, __m128i b)
+            {
+                __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+                lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+                return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+            };
+
+            uint32_t x = 0;
+
+            for (; (x + 4) * 2 <= inWidth; x += 4)
+            {
+                __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+                __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+                __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+                __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_packus_epi16(fold(a0, b0), fold(a1, b1)));
+            }
+
+            boxRow<uint8_t, 4>(in, inWidth, inHeight, out, outWidth, y, x);
+        });
+    }
+#endif
+
+    // Separable float filter: source rows are decoded and filtered horizontally once, then output rows
+    // combine kernel rows vertically. Result is clamped, Kaiser lobes may overshoot.
+    template<class T, uint32_t Channels>
+    void filterLevel(const T* in, uint32_t inWidth, uint32_t inHeight, T* out, uint32_t outWidth, uint32_t outHeight, const Kernel& kernel, bool srgb)
+    {
+        constexpr float Scale = float(std::numeric_limits<T>::max());
+
+        const SrgbTables& tables = srgbTables();
+        const int32_t shift = int32_t(kernel.taps / 2) - 1;
+
+        auto decode = [&](T value, uint32_t c) -> float
+        {
+            return srgb && c < 3 ? tables.toLinear[value] : value / Scale;
+        };
+
+        auto encode = [&](float value, uint32_t c) -> T
+        {
+            value = std::clamp(value, 0.0f, 1.0f);
+
+            return srgb && c < 3 ? T(tables.fromLinear[uint32_t(value * 65535.0f + 0.5f)]) : T(value * Scale + 0.5f);
+        };
+
+        // Source columns of every output column, clamped at edges
+        std::vector<uint32_t> columns(size_t(outWidth) * kernel.taps);
+
+        for (uint32_t x = 0; x < outWidth; x++)
+            for (uint32_t k = 0; k < kernel.taps; k++)
+                columns[x * kernel.taps + k] = std::clamp(int32_t(x * 2 + k) - shift, 0, int32_t(inWidth) - 1);
+
+        std::vector<float> rows(size_t(outWidth) * inHeight * Channels);
+
+        ParallelFor(0, inHeight, [&](uint32_t y)
+        {
+            const T* src = in + size_t(y) * inWidth * Channels;
+            float* dst = rows.data() + size_t(y) * outWidth * Channels;
+
+            float texels[6][Channels];
+
+            for (uint32_t x = 0; x < outWidth; x++)
+            {
+                for (uint32_t k = 0; k < kernel.taps; k++)
+                    for (uint32_t c = 0; c < Channels; c++) texels[k][c] = decode(src[columns[x * kernel.taps + k] * Channels + c], c);
+
+                for (uint32_t c = 0; c < Channels; c++)
+                {
+                    float sum = 0.0f;
+
+                    for (uint32_t k = 0; k < kernel.taps; k++) sum += kernel.weights[k] * texels[k][c];
+
+                    dst[x * Channels + c] = sum;
+                }
+            }
+        });
+
+        ParallelFor(0, outHeight, [&](uint32_t y)
+        {
+            const float* taps[6];
+
+            for (uint32_t k = 0; k < kernel.taps; k++)
+                taps[k] = rows.data() + size_t(std::clamp(int32_t(y * 2 + k) - shift, 0, int32_t(inHeight) - 1)) * outWidth * Channels;
+
+            T* dst = out + size_t(y) * outWidth * Channels;
+
+            for (uint32_t i = 0; i < outWidth * Channels; i++)
+            {
+                float sum = 0.0f;
+
+                for (uint32_t k = 0; k < kernel.taps; k++) sum += kernel.weights[k] * taps[k][i];
+
+                dst[i] = encode(sum, i % Channels);
+            }
+        });
+    }
+
+    template<class T, uint32_t Channels>
+    void buildLevels(uint8_t* data, uint32_t width, uint32_t height, size_t mipmaps, MipFilter filter, bool srgb)
+    {
+        T* in = reinterpret_cast<T*>(data);
+
+        for (size_t i = 1; i < mipmaps; i++)
+        {
+            T* out = in + size_t(width) * height * Channels;
+
+            uint32_t outWidth = std::max(width / 2, 1u);
+            uint32_t outHeight = std::max(height / 2, 1u);
+
+            if (filter == MipFilter::Box && !srgb)
+                boxLevel<T, Channels>(in, width, height, out, outWidth, outHeight);
+            else
+                filterLevel<T, Channels>(in, width, height, out, outWidth, outHeight, filter == MipFilter::Kaiser ? kaiserKernel() : BoxKernel, srgb);
+
+            in = out;
+            width = outWidth;
+            height = outHeight;
+        }
+    }
+}
+
+void BuildMipmaps(uint8_t* data, uint32_t width, uint32_t height, VkFormat format, size_t mipmaps, MipFilter filter, bool srgb)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM: buildLevels<uint8_t, 4>(data, width, height, mipmaps, filter, srgb); break;
+    case VK_FORMAT_R8_UNORM: buildLevels<uint8_t, 1>(data, width, height, mipmaps, filter, false); break;
+    case VK_FORMAT_R16_UNORM: buildLevels<uint16_t, 1>(data, width, height, mipmaps, filter, false); break;
+    default: throw std::runtime_error("BuildMipmaps: unsupported format!");
+    }
+}
@@ -1,10 +1,13 @@
 #include "Image.h"
+#include "BlockCompress.h"
+#include "Tex.h"
 
 #include <png.h>
 #include "Render/Render.h"
 #include <iostream>
+#include <vector>
 
-Image* LoadPNG(const char* filename, bool mipmaps, bool rawdata)
+bool DecodePNG(const char* filename, Image& image)
 {
     FILE* file;
 
@@ -13,24 +16,22 @@ Image* LoadPNG(const char* filename, bool mipmaps, bool rawdata)
 	if (error)
 	{
 		std::cout << "Can't open file " << filename << std::endl;
-		return nullptr;
+		return false;
 	}
 
 	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (!png) return nullptr;
+	if (!png) return false;
 
 	png_infop info = png_create_info_struct(png);
-	if (!info) return nullptr;
+	if (!info) return false;
 
-	if (setjmp(png_jmpbuf(png))) return nullptr;
+	if (setjmp(png_jmpbuf(png))) return false;
 
 	png_init_io(png, file);
 	png_read_info(png, info);
 
-	Image* image = new Image();
-
-	image->width = png_get_image_width(png, info);
-	image->height = png_get_image_height(png, info);
+	image.width = png_get_image_width(png, info);
+	image.height = png_get_image_height(png, info);
 	png_byte colortype = png_get_color_type(png, info);
 	png_byte bitdepth = png_get_bit_depth(png, info);
 
@@ -53,72 +54,153 @@ Image* LoadPNG(const char* filename, bool mipmaps, bool rawdata)
 	if (colortype == PNG_COLOR_TYPE_PALETTE)
 	{
 		png_set_palette_to_rgb(png);
-		image->format = VK_FORMAT_R8G8B8A8_UNORM;
+		image.format = VK_FORMAT_R8G8B8A8_UNORM;
 	}
 	else if (colortype == PNG_COLOR_TYPE_GRAY)
 	{
 		if (bitdepth < 8)
 		{
 			png_set_expand_gray_1_2_4_to_8(png);
-			image->format = VK_FORMAT_R8_UNORM;
+			image.format = VK_FORMAT_R8_UNORM;
 		}
 		else if (bitdepth == 8)
 		{
-			image->format = VK_FORMAT_R8_UNORM;
+			image.format = VK_FORMAT_R8_UNORM;
 		}
 		else
 		{
-			image->format = VK_FORMAT_R16_UNORM;
+			image.format = VK_FORMAT_R16_UNORM;
 			png_set_swap(png);
 		}
 	} 
 	else
-		image->format = VK_FORMAT_R8G8B8A8_UNORM;
+		image.format = VK_FORMAT_R8G8B8A8_UNORM;
 
 	if (png_get_valid(png, info, PNG_INFO_tRNS))
 		png_set_tRNS_to_alpha(png);
 
 	png_read_update_info(png, info);
 
-	image->mipmaps = mipmaps ? log2(std::min(image->width, image->height)) + 1 : 1;
-	size_t dataSize = image->size();
-
-	uint32_t width = image->width;
-	uint32_t height = image->height;
-
-	size_t memsize = image->size();
+	image.mipmaps = 1;
 
 	// Read image
-	Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, dataSize);
-	uint8_t* data = reinterpret_cast<uint8_t*>(buffer.map(dataSize));
+	uint8_t* data = new uint8_t[image.size()];
 
-	png_bytep* rows = new png_bytep[image->height];
+	png_bytep* rows = new png_bytep[image.height];
 
-	for (uint32_t y = 0; y < image->height; y++) 
+	for (uint32_t y = 0; y < image.height; y++) 
 	{
 		rows[y] = (png_byte*)data + png_get_rowbytes(png, info) * y;
 	}
 
 	png_read_image(png, rows);
 
-	// Calculate mipmaps
-	if (mipmaps) BuildMipmaps(data, image->width, image->height, image->format, image->mipmaps);
+	image.data = data;
+
+	fclose(file);
+
+	png_destroy_read_struct(&png, &info, NULL);
+	delete[] rows;
+
+	return true;
+}
+
+Image* DecodePNG(const char* filename)
+{
+	Image* image = new Image();
 
-	// Copy image to CPU memory
-	if (rawdata)
+	if (!DecodePNG(filename, *image))
 	{
-		size_t size = image->width * image->height * pixelsize(image->format);
-		image->data = new uint8_t * [size];
-		memcpy(image->data, data, size);
+		delete image;
+		return nullptr;
 	}
 
-	buffer.unmap();
-	fclose(file);
+	return image;
+}
 
-	png_destroy_read_struct(&png, &info, NULL);
-	delete rows;
+void PreparePNG(Image& image, bool mipmaps, VkFormat format, TextureData& texture, bool srgb)
+{
+	size_t levelSize = image.size();
+
+	image.mipmaps = mipmaps ? log2(std::min(image.width, image.height)) + 1 : 1;
+	size_t dataSize = image.size();
+
+	// Devices without the block-compressed format keep RGBA8 source
+	bool compress = blockdim(format) > 1 && image.format == VK_FORMAT_R8G8B8A8_UNORM && Render::VulkanInstance::GetInstance().compressedFormat(format);
+
+	// Formats with linear blit get their chain on GPU from first level, data holds one level only.
+	// Blit of UNORM colors averages encoded values, so they stay on CPU.
+	bool linearLight = srgb && image.format == VK_FORMAT_R8G8B8A8_UNORM;
+	texture.generateMips = !compress && !linearLight && image.mipmaps > 1 && Render::VulkanInstance::GetInstance().blitMipmaps(image.format);
+
+	if (texture.generateMips)
+	{
+		texture.data.assign(reinterpret_cast<uint8_t*>(image.data), reinterpret_cast<uint8_t*>(image.data) + levelSize);
+		texture.regions = LevelRegions(image, 1);
+	}
+	else if (!compress)
+	{
+		texture.data.resize(dataSize);
+		memcpy(texture.data.data(), image.data, levelSize);
 
-	Render::VulkanInstance::GetInstance().createTexture(buffer, *image);
+		// Calculate mipmaps
+		if (mipmaps) BuildMipmaps(texture.data.data(), image.width, image.height, image.format, image.mipmaps, MipFilter::Box, srgb);
+
+		texture.regions = LevelRegions(image, image.mipmaps);
+	}
+	else
+	{
+		// Mip chain is filtered uncompressed, then every level is compressed
+		std::vector<uint8_t> levels(dataSize);
+
+		memcpy(levels.data(), image.data, levelSize);
+
+		// Color levels are filtered in linear light, normal map xy as is
+		if (mipmaps) BuildMipmaps(levels.data(), image.width, image.height, image.format, image.mipmaps, MipFilter::Box, srgb);
+
+		VkFormat source = image.format;
+		image.format = format;
+
+		texture.data.resize(image.size());
+
+		uint8_t* data = texture.data.data();
+		uint32_t width = image.width;
+		uint32_t height = image.height;
+		const uint8_t* in = levels.data();
+
+		for (size_t i = 0; i < image.mipmaps; i++)
+		{
+			std::vector<uint8_t> blocks = CompressLevel(in, width, height, format);
+
+			memcpy(data, blocks.data(), blocks.size());
+
+			data += blocks.size();
+			in += levelsize(source, width, height);
+
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+		}
+
+		texture.regions = LevelRegions(image, image.mipmaps);
+	}
+}
+
+Image* LoadPNG(const char* filename, bool mipmaps, bool rawdata, VkFormat format)
+{
+	Image* image = DecodePNG(filename);
+	if (!image) return nullptr;
+
+	TextureData texture;
+	PreparePNG(*image, mipmaps, format, texture, !IsNormalMap(filename));
+
+	UploadTextures({ { image, &texture } });
+
+	// Keep decoded first level in CPU memory
+	if (!rawdata)
+	{
+		delete[] reinterpret_cast<uint8_t*>(image->data);
+		image->data = nullptr;
+	}
 
     return image;
-}
\ No newline at end of file
+}
@@ -0,0 +1,298 @@
+#include "Image.h"
+#include "Tex.h"
+#include "BlockCompress.h"
+
+#include "Render/Render.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+// Level offsets satisfy copy alignment of every format
+constexpr uint64_t LevelAlignment = 16;
+
+std::string CookedPath(const char* filename)
+{
+    std::string path = std::string("cooked/") + filename;
+
+    size_t extension = path.find_last_of('.');
+    size_t directory = path.find_last_of("/\\");
+
+    if (extension != std::string::npos && (directory == std::string::npos || extension > directory)) path.resize(extension);
+
+    return path + ".tex";
+}
+
+bool IsNormalMap(const char* filename)
+{
+    std::string stem = std::filesystem::path(filename).stem().string();
+
+    return (stem.size() > 2 && stem.compare(stem.size() - 2, 2, "_n") == 0) || stem.rfind("waves", 0) == 0;
+}
+
+bool ReadTexHeader(const char* filename, TexHeader& header)
+{
+    FILE* file;
+
+    if (fopen_s(&file, filename, "rb")) return false;
+
+    bool valid = fread(&header, sizeof(TexHeader), 1, file) == 1 && header.magic == TexMagic && header.version == TexVersion;
+
+    fclose(file);
+
+    return valid;
+}
+
+void WriteTEX(const char* filename, VkFormat format, uint64_t sourceHash, const std::vector<TexLevelData>& levels)
+{
+    TexHeader header = { TexMagic, TexVersion, format, levels[0].width, levels[0].height, uint32_t(levels.size()), sourceHash };
+
+    std::vector<TexLevel> table(levels.size());
+    uint64_t offset = 0;
+
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        table[i] = { levels[i].width, levels[i].height, offset, levels[i].data.size() };
+        offset = (offset + levels[i].data.size() + LevelAlignment - 1) & ~(LevelAlignment - 1);
+    }
+
+    std::filesystem::path path = filename;
+    std::filesystem::path temp = path;
+    temp += ".tmp";
+
+    {
+        std::ofstream file(temp, std::ios::binary);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(TexLevel));
+
+        const char padding[LevelAlignment] = {};
+
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            file.write(reinterpret_cast<const char*>(levels[i].data.data()), levels[i].data.size());
+
+            if (i + 1 < levels.size()) file.write(padding, table[i + 1].offset - table[i].offset - table[i].size);
+        }
+
+        if (!file) throw std::runtime_error("WriteTEX: can't write " + temp.string());
+    }
+
+    std::filesystem::rename(temp, path);
+}
+
+// Reads header and level table, file is left at level data. nullptr if file can't be opened.
+static FILE* openTEX(const char* filename, Image& image, std::vector<TexLevel>& levels)
+{
+    FILE* file;
+
+    errno_t error = fopen_s(&file, filename, "rb");
+
+    if (error)
+    {
+        std::cout << "Can't open file " << filename << std::endl;
+        return nullptr;
+    }
+
+    TexHeader header;
+
+    if (fread(&header, sizeof(TexHeader), 1, file) != 1 || header.magic != TexMagic || header.version != TexVersion)
+    {
+        fclose(file);
+        throw std::runtime_error("LoadTEX: incorrect header!");
+    }
+
+    levels.resize(header.mipmaps);
+
+    if (fread(levels.data(), sizeof(TexLevel), levels.size(), file) != levels.size())
+    {
+        fclose(file);
+        throw std::runtime_error("LoadTEX: truncated level table!");
+    }
+
+    image.format = header.format;
+    image.width = header.width;
+    image.height = header.height;
+    image.mipmaps = header.mipmaps;
+
+    return file;
+}
+
+// Block-compressed levels the device can't sample are expanded to RGBA8, level table follows new layout
+static bool expandable(VkFormat format)
+{
+    return blockdim(format) > 1 && !Render::VulkanInstance::GetInstance().compressedFormat(format);
+}
+
+static std::vector<uint8_t> expandLevels(Image& image, std::vector<TexLevel>& levels, const uint8_t* data)
+{
+    std::vector<uint8_t> expanded;
+
+    for (TexLevel& level : levels)
+    {
+        std::vector<uint8_t> texels = DecompressLevel(data + level.offset, level.width, level.height, image.format);
+
+        level.offset = expanded.size();
+        level.size = texels.size();
+
+        expanded.insert(expanded.end(), texels.begin(), texels.end());
+        expanded.resize((expanded.size() + LevelAlignment - 1) / LevelAlignment * LevelAlignment);
+    }
+
+    image.format = VK_FORMAT_R8G8B8A8_UNORM;
+
+    return expanded;
+}
+
+static std::vector<VkBufferImageCopy> levelRegions(const std::vector<TexLevel>& levels)
+{
+    std::vector<VkBufferImageCopy> regions(levels.size());
+
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        regions[i] = {};
+        regions[i].bufferOffset = levels[i].offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.baseArrayLayer = 0;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = { 0, 0, 0 };
+        regions[i].imageExtent = { levels[i].width, levels[i].height, 1 };
+    }
+
+    return regions;
+}
+
+bool ReadTEX(const char* filename, Image& image, TextureData& texture, uint32_t firstMip)
+{
+    std::vector<TexLevel> levels;
+
+    FILE* file = openTEX(filename, image, levels);
+    if (!file) return false;
+
+    // Finer levels are skipped, offsets become relative to first level read
+    firstMip = std::min(firstMip, uint32_t(levels.size()) - 1);
+
+    uint64_t skipped = levels[firstMip].offset;
+
+    levels.erase(levels.begin(), levels.begin() + firstMip);
+    for (TexLevel& level : levels) level.offset -= skipped;
+
+    image.width = levels[0].width;
+    image.height = levels[0].height;
+    image.mipmaps = levels.size();
+
+    texture.data.resize(levels.back().offset + levels.back().size);
+
+    size_t read = fseek(file, long(skipped), SEEK_CUR) == 0 ? fread(texture.data.data(), 1, texture.data.size(), file) : 0;
+
+    fclose(file);
+
+    if (read != texture.data.size()) throw std::runtime_error("LoadTEX: truncated level data!");
+
+    if (expandable(image.format)) texture.data = expandLevels(image, levels, texture.data.data());
+
+    texture.regions = levelRegions(levels);
+    texture.generateMips = false;
+
+    return true;
+}
+
+Image* LoadTEX(const char* filename, bool rawdata)
+{
+    Image* image = new Image();
+
+    std::vector<TexLevel> levels;
+    FILE* file;
+
+    try
+    {
+        file = openTEX(filename, *image, levels);
+    }
+    catch (...)
+    {
+        delete image;
+        throw;
+    }
+
+    if (!file)
+    {
+        delete image;
+        return nullptr;
+    }
+
+    size_t dataSize = levels.back().offset + levels.back().size;
+
+    // Expanded levels pass through CPU memory, others go straight from file to staging memory
+    std::vector<uint8_t> expanded;
+
+    if (expandable(image->format))
+    {
+        std::vector<uint8_t> blocks(dataSize);
+
+        size_t read = fread(blocks.data(), 1, dataSize, file);
+
+        fclose(file);
+
+        if (read != dataSize)
+        {
+            delete image;
+            throw std::runtime_error("LoadTEX: truncated level data!");
+        }
+
+        expanded = expandLevels(*image, levels, blocks.data());
+        dataSize = expanded.size();
+    }
+
+    Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, dataSize);
+    uint8_t* data = reinterpret_cast<uint8_t*>(buffer.map(dataSize));
+
+    if (!expanded.empty())
+    {
+        memcpy(data, expanded.data(), dataSize);
+    }
+    else
+    {
+        size_t read = fread(data, 1, dataSize, file);
+
+        fclose(file);
+
+        if (read != dataSize)
+        {
+            buffer.unmap();
+            delete image;
+            throw std::runtime_error("LoadTEX: truncated level data!");
+        }
+    }
+
+    // Copy first level to CPU memory
+    if (rawdata)
+    {
+        image->data = new uint8_t[levels[0].size];
+        memcpy(image->data, data + levels[0].offset, levels[0].size);
+    }
+
+    buffer.unmap();
+
+    TextureData texture;
+    texture.regions = levelRegions(levels);
+
+    Render::VulkanInstance::GetInstance().createTextures(buffer, { { image, &texture, 0 } });
+
+    return image;
+}
+
+Image* LoadCooked(const char* filename, bool rawdata)
+{
+    std::string path = CookedPath(filename);
+
+    TexHeader header;
+
+    if (!ReadTexHeader(path.c_str(), header)) return nullptr;
+
+    return LoadTEX(path.c_str(), rawdata);
+}
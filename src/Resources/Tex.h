@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Cooked texture container written by terrain-cook: header, level table, then level data laid out
+// exactly as it is copied to the GPU image
+constexpr uint32_t TexMagic = 0x31584554;   // "TEX1"
+constexpr uint32_t TexVersion = 1;
+
+struct TexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipmaps;
+    uint64_t sourceHash;    // Hash of source file and cook settings, cooker skips outputs with matching hash
+};
+
+struct TexLevel
+{
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;        // From start of level data
+    uint64_t size;
+};
+
+// Cooked counterpart of source asset: cooked/<path without extension>.tex
+std::string CookedPath(const char* filename);
+
+// Normal maps are named *_n or waves*, their levels are filtered as vectors rather than colors
+bool IsNormalMap(const char* filename);
+
+bool ReadTexHeader(const char* filename, TexHeader& header);
+
+// Level of container being written, data in final format
+struct TexLevelData
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+};
+
+// Written aside and renamed, interrupted write never leaves truncated container with valid header
+void WriteTEX(const char* filename, VkFormat format, uint64_t sourceHash, const std::vector<TexLevelData>& levels);
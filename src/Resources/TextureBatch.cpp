@@ -0,0 +1,157 @@
+#include "TextureBatch.h"
+#include "Tex.h"
+
+#include "Parallel.h"
+#include "Timeline.h"
+
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <cstring>
+
+TextureBatch::TextureBatch()
+{
+    uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (uint32_t i = 0; i < threads; i++) m_workers.emplace_back(&TextureBatch::worker, this);
+}
+
+TextureBatch::~TextureBatch()
+{
+    {
+        std::lock_guard<SpinLock> lock(m_lock);
+        m_closed = true;
+    }
+
+    m_jobAdded.notify_all();
+
+    for (std::thread& worker : m_workers)
+        if (worker.joinable()) worker.join();
+}
+
+Image* TextureBatch::add(const char* filename, VkFormat format)
+{
+    Image* image = new Image();
+
+    {
+        std::lock_guard<SpinLock> lock(m_lock);
+
+        if (m_closed) throw std::runtime_error("TextureBatch: add after upload!");
+
+        m_jobs.push_back({ filename, format, image });
+    }
+
+    m_jobAdded.notify_one();
+
+    return image;
+}
+
+void TextureBatch::worker()
+{
+    // Jobs run in parallel, filtering inside one job stays on this thread
+    t_parallelWorker = true;
+
+    while (true)
+    {
+        Job* job;
+
+        {
+            std::unique_lock<SpinLock> lock(m_lock);
+
+            m_jobAdded.wait(lock, [this] { return m_next < m_jobs.size() || m_closed; });
+
+            if (m_next == m_jobs.size()) return;
+
+            job = &m_jobs[m_next++];
+        }
+
+        StartupPhase phase("texture decode");
+
+        try
+        {
+            decode(*job);
+        }
+        catch (const std::exception& e)
+        {
+            job->error = e.what();
+        }
+
+        std::lock_guard<SpinLock> lock(m_lock);
+        m_finished++;
+    }
+}
+
+bool TextureBatch::ready()
+{
+    std::lock_guard<SpinLock> lock(m_lock);
+
+    return m_finished == m_jobs.size();
+}
+
+void TextureBatch::decode(Job& job)
+{
+    const char* filename = job.filename.c_str();
+    const char* extension = strrchr(filename, '.');
+
+    if (extension && strcmp(extension + 1, "tex") == 0)
+    {
+        if (!ReadTEX(filename, *job.image, job.texture)) throw std::runtime_error("can't open file");
+        return;
+    }
+
+    // Cooked assets come with mip chain and GPU format, source is decoded only when nothing is cooked
+    std::string cooked = CookedPath(filename);
+    TexHeader header;
+
+    if (ReadTexHeader(cooked.c_str(), header) && ReadTEX(cooked.c_str(), *job.image, job.texture)) return;
+
+    if (!extension || strcmp(extension + 1, "png") != 0) throw std::runtime_error("unknown image type");
+
+    if (!DecodePNG(filename, *job.image)) throw std::runtime_error("can't decode file");
+
+    PreparePNG(*job.image, true, job.format, job.texture, !IsNormalMap(filename));
+
+    delete[] reinterpret_cast<uint8_t*>(job.image->data);
+    job.image->data = nullptr;
+}
+
+void TextureBatch::upload()
+{
+    {
+        StartupPhase phase("texture decode wait");
+
+        {
+            std::lock_guard<SpinLock> lock(m_lock);
+            m_closed = true;
+        }
+
+        m_jobAdded.notify_all();
+
+        for (std::thread& worker : m_workers) worker.join();
+
+        m_workers.clear();
+    }
+
+    for (const Job& job : m_jobs)
+        if (!job.error.empty()) throw std::runtime_error("TextureBatch: " + job.filename + ": " + job.error);
+
+    StartupPhase phase("texture upload");
+
+    std::vector<std::pair<Image*, const TextureData*>> textures;
+    size_t dataSize = 0;
+
+    for (const Job& job : m_jobs)
+    {
+        textures.push_back({ job.image, &job.texture });
+        dataSize += job.texture.data.size();
+    }
+
+    UploadTextures(textures);
+
+    std::cout << "Texture batch: " << textures.size() << " textures, " << dataSize / (1024 * 1024) << " MB staged" << std::endl;
+
+    // CPU copies are no longer needed
+    m_jobs.clear();
+    m_next = 0;
+    m_finished = 0;
+}
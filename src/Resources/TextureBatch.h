@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Image.h"
+#include "Sync.h"
+
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <string>
+
+// Textures decoded on worker threads while the owner keeps constructing, then created with one staging
+// buffer and one submit. Cooked containers are read as is, sources are decoded, filtered and compressed.
+class TextureBatch
+{
+    struct Job
+    {
+        std::string filename;
+        VkFormat format;
+        Image* image;
+        TextureData texture;
+        std::string error;
+    };
+
+    std::deque<Job> m_jobs;
+    size_t m_next = 0;
+    size_t m_finished = 0;
+    bool m_closed = false;
+
+    SpinLock m_lock;
+    std::condition_variable_any m_jobAdded;
+
+    std::vector<std::thread> m_workers;
+
+private:
+    void worker();
+    static void decode(Job& job);
+
+public:
+    TextureBatch();
+    ~TextureBatch();
+
+    // Image gets its GPU texture on upload, caller owns it
+    Image* add(const char* filename, VkFormat format = VK_FORMAT_UNDEFINED);
+
+    // True when every job added so far is decoded, upload then doesn't block
+    bool ready();
+
+    // Waits for decode jobs and creates every texture added so far, throws if some file failed
+    void upload();
+};
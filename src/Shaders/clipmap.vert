@@ -0,0 +1,82 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform UniformBufferObject 
+{
+    mat4 proj;
+    vec3 pos;
+} view;
+
+layout(push_constant, std430) uniform constants
+{
+    float size;
+    layout(offset = 4) float hscale;
+    layout(offset = 12) uint level;
+    layout(offset = 16) ivec2 center;
+    layout(offset = 24) float texelSize;
+    layout(offset = 28) uint levels;
+
+} params;
+
+layout(binding = 1) uniform sampler2DArray clipmap;
+
+// Reflection pass permutation, geometry below water plane is clipped
+layout(constant_id = 0) const bool ClipPlane = false;
+layout(constant_id = 22) const float ClipHeight = 10.0;    // Specialized from App::WaterLevel
+
+// Specialized from Clipmap::GridSize and Clipmap::TextureSize
+layout(constant_id = 20) const int GridSize = 64;
+layout(constant_id = 21) const int TextureSize = 128;
+const float BlendWidth = 8.0;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec2 fragTerCoord;
+layout(location = 3) out float fragHeight;
+layout(location = 4) flat out ivec3 fragNormalSlot;
+layout(location = 5) out vec2 fragNormalPos;
+
+float height(ivec2 texel)
+{
+    // Texture array layer wraps around, level texel maps to fixed slot
+    return texelFetch(clipmap, ivec3(texel & (TextureSize - 1), params.level), 0).r;
+}
+
+void main() 
+{
+    // Index value encodes grid vertex, centered around level center
+    const int stride = GridSize + 1;
+    ivec2 grid = ivec2(gl_VertexIndex % stride, gl_VertexIndex / stride) - GridSize / 2;
+    ivec2 texel = params.center + grid;
+
+    float h = height(texel);
+
+    // Near outer edge heights blend to coarser level, so that the border matches next ring
+    if (params.level + 1 < params.levels)
+    {
+        float dist = float(max(abs(grid.x), abs(grid.y)));
+        float blend = clamp((dist - (GridSize / 2 - BlendWidth)) / BlendWidth, 0.0, 1.0);
+
+        // Odd vertices lie on coarse edge or diagonal, coarse height is average of its end points
+        ivec2 odd = texel & 1;
+        ivec2 dir = ivec2(odd.x, -odd.y);
+
+        float coarse = 0.5 * (height(texel + dir) + height(texel - dir));
+        h = mix(h, coarse, blend);
+    }
+
+    vec2 pos = vec2(texel << params.level) * params.texelSize - params.size * 0.5;
+
+    vec4 world_pos = vec4(pos.x, h * params.hscale, pos.y, 1.0);
+    gl_Position = view.proj * world_pos;
+
+    fragPos = world_pos.xyz;
+    fragTexCoord = pos * 0.5;
+    fragTerCoord = pos / params.size + 0.5;
+    fragHeight = world_pos.y;
+    // Unused, terrain.frag reads normal texture on this path
+    fragNormalSlot = ivec3(0);
+    fragNormalPos = vec2(0.0);
+
+    gl_ClipDistance[0] = ClipPlane ? world_pos.y - ClipHeight : 1.0;
+}
@@ -0,0 +1,18 @@
+// Helpers shared by terrain and water shaders
+
+// Normal maps may be cooked to two channels (BC5), z is rebuilt from unit length
+vec3 unpackNormal(vec2 xy)
+{
+    xy = xy * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
+// Octahedral normal encoding, inverse of octEncode in TerrainData
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+    if (n.z < 0.0) n.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(n);
+}
@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform sampler2D scene;
+
+layout(location = 0) out vec4 outColor;
+
+void main() 
+{
+    outColor = vec4(texelFetch(scene, ivec2(gl_FragCoord.xy), 0).rgb, 1.0);
+}
@@ -1,6 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+layout(early_fragment_tests) in;
+
 layout(binding = 0) uniform UniformBufferObject 
 {
     mat4 proj;
@@ -1,10 +1,16 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 layout(location = 0) in vec2 fragTexCoord;
 layout(location = 1) in float fragAlpha;
 
-layout(binding = 1) uniform sampler2D diffuse;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(push_constant) uniform constants
+{
+    layout(offset = 4) uint clouds;     // texture table slot
+} params;
 
 layout(location = 0) out vec4 outColor;
 
@@ -12,6 +18,6 @@ void main()
 {
     float alpha = 1.0 - clamp(fragAlpha, 0.0, 1.0);
 
-    vec3 color = texture(diffuse, fragTexCoord).xyz;
+    vec3 color = texture(textures[params.clouds], fragTexCoord).xyz;
     outColor = vec4(color, alpha * alpha);
 }
\ No newline at end of file
@@ -20,7 +20,8 @@ layout(location = 1) out float fragAlpha;
 void main() 
 {
     vec4 world_pos = vec4(inPosition, 1.0);
-    gl_Position = view.proj * world_pos;
+    // Dome is projected onto far plane so it can be drawn after terrain with depth test
+    gl_Position = (view.proj * world_pos).xyww;
 
     vec2 tcoord = vec4(inPosition, 1.0).xz;
     vec2 tex_offset = vec2(1, 1) * params.animTime;
@@ -1,22 +1,90 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 layout(location = 0) in vec3 fragPos;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec2 fragTerCoord;
 layout(location = 3) in float fragHeight;
+layout(location = 4) flat in ivec3 fragNormalSlot;      // CDLOD only, see terrain.vert
+layout(location = 5) in vec2 fragNormalPos;
 
-layout(binding = 2) uniform sampler2D normals;          // geometry normals
-layout(binding = 3) uniform sampler2D diffuse_map[3];
-layout(binding = 4) uniform sampler2D normal_map[3];
+layout(binding = 2) uniform sampler2D normals;          // geometry normals, heightmap when derived, page atlas in CDLOD
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];    // Instance texture table
+
+layout(push_constant, std430) uniform constants
+{
+    layout(offset = 112) uint normalFormat;     // 0 RGBA8, 1 octahedral RG8, 2 octahedral RG16, 3 derived
+    layout(offset = 116) float slopeScale;      // Normal slope per height difference of neighbour texels
+    layout(offset = 120) uint diffuseSlots;     // Texture table slots of grass, dirt, rock, 10 bits each
+    layout(offset = 124) uint normalSlots;
+} params;
 
 layout(location = 0) out vec4 outColor;
 
 const vec3 lightDir = normalize(vec3(0.8, 1, 0.8));
 
-const float DirtLevel = 10.0;
-const float RockLevel = 30.0;
-const float Transition = 5.0;
+// Material heights, specialized from App constants
+layout(constant_id = 16) const float DirtLevel = 10.0;
+layout(constant_id = 17) const float RockLevel = 30.0;
+layout(constant_id = 18) const float Transition = 5.0;
+
+// CDLOD reads geometry normals from VirtualHeightmap page picked in vertex stage
+layout(constant_id = 19) const bool PagedNormals = false;
+
+const int PageSize = 64;
+
+#include "common.glsl"
+
+vec4 sampleAtlas(vec2 pos)
+{
+    return textureLod(normals, (vec2(fragNormalSlot.xy) + pos + 0.5) / vec2(textureSize(normals, 0)), 0.0);
+}
+
+// Normals of tile page are filtered inside it, finer than tile vertices, see Terrain::normalPage
+vec3 pageNormal()
+{
+    vec2 pos = clamp(fragNormalPos, 0.0, float(PageSize));
+
+    if (params.normalFormat == 0) return normalize(sampleAtlas(pos).xyz * 2.0 - 1.0);
+    if (params.normalFormat < 3) return octDecode(sampleAtlas(pos).xy);
+
+    // Central differences on heights of the page, clamped to its texels
+    vec2 lo = max(pos - 1.0, 0.0);
+    vec2 hi = min(pos + 1.0, float(PageSize));
+
+    float dx = sampleAtlas(vec2(hi.x, pos.y)).r - sampleAtlas(vec2(lo.x, pos.y)).r;
+    float dy = sampleAtlas(vec2(pos.x, hi.y)).r - sampleAtlas(vec2(pos.x, lo.y)).r;
+
+    float spacing = float(1 << fragNormalSlot.z);
+
+    return normalize(vec3(-dx / (hi.x - lo.x), dy / (hi.y - lo.y), spacing / params.slopeScale));
+}
+
+// Geometry normal as stored by TerrainData, (-dh/dx, dh/dy, 1) normalized
+vec3 geometryNormal(vec2 coord)
+{
+    if (PagedNormals) return pageNormal();
+
+    if (params.normalFormat == 0) return normalize(texture(normals, coord).xyz * 2.0 - 1.0);
+    if (params.normalFormat < 3) return octDecode(texture(normals, coord).xy);
+
+    // Central differences on heightmap level of screen footprint
+    float lod = max(floor(textureQueryLod(normals, coord).x), 0.0);
+    float spacing = exp2(lod);
+    vec2 texel = spacing / vec2(textureSize(normals, 0));
+
+    float dx = textureLod(normals, coord + vec2(texel.x, 0.0), lod).r - textureLod(normals, coord - vec2(texel.x, 0.0), lod).r;
+    float dy = textureLod(normals, coord + vec2(0.0, texel.y), lod).r - textureLod(normals, coord - vec2(0.0, texel.y), lod).r;
+
+    return normalize(vec3(-dx, dy, 2.0 * spacing / params.slopeScale));
+}
+
+uint materialSlot(uint slots, uint material)
+{
+    return (slots >> (material * 10)) & 0x3ff;
+}
 
 void main() 
 {
@@ -50,17 +118,18 @@ void main()
         blend = (fragHeight - RockLevel) / Transition;
     }
 
-    vec3 diffuse1 = texture(diffuse_map[tid1], fragTexCoord).xyz;
-    vec3 normal1 = texture(normal_map[tid1], fragTexCoord).xyz * 2.0 - 1.0;
+    // Material varies across a draw, table index is not dynamically uniform
+    vec3 diffuse1 = texture(textures[nonuniformEXT(materialSlot(params.diffuseSlots, tid1))], fragTexCoord).xyz;
+    vec3 normal1 = unpackNormal(texture(textures[nonuniformEXT(materialSlot(params.normalSlots, tid1))], fragTexCoord).xy);
 
-    vec3 diffuse2 = texture(diffuse_map[tid2], fragTexCoord).xyz;
-    vec3 normal2 = texture(normal_map[tid2], fragTexCoord).xyz * 2.0 - 1.0;
+    vec3 diffuse2 = texture(textures[nonuniformEXT(materialSlot(params.diffuseSlots, tid2))], fragTexCoord).xyz;
+    vec3 normal2 = unpackNormal(texture(textures[nonuniformEXT(materialSlot(params.normalSlots, tid2))], fragTexCoord).xy);
 
     vec3 diffuse = mix(diffuse1, diffuse2, blend);
     vec3 normal = mix(normal1, normal2, blend);
 
-    // Tangent space
-    vec3 tspacez = textureLod(normals, fragTerCoord, 0.0).xzy * 2.0 - 1.0;
+    // Tangent space, mip follows screen footprint so distant terrain reads coarse levels
+    vec3 tspacez = geometryNormal(fragTerCoord).xzy;
     vec3 tspacex = normalize(vec3(1, 0, 0) - tspacez * tspacez.x);
     vec3 tspacey = normalize(vec3(0, 0, 1) - tspacez * tspacez.z);
 
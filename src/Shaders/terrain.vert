@@ -11,20 +11,36 @@ layout(push_constant, std430) uniform constants
 {
     float size;
     layout(offset = 4) float hscale;
-    layout(offset = 8) uint clip;
     layout(offset = 12) float loddist;
     layout(offset = 16) mat4 modelMat;
+    layout(offset = 80) uint grid;
+    layout(offset = 84) uint mip;       // Heightmap mip of tile vertex spacing
+    layout(offset = 88) uint page;      // Page of tile in that mip, x | y << 16
+    layout(offset = 92) uint entry;     // Page table texel of page, x | y << 16
+    layout(offset = 96) uvec4 edges;    // -x, +x, -z, +z: snap of lower half, upper half, same level flag
     
 } params;
 
-layout(binding = 1) uniform sampler2D heightmap;
+// Reflection pass permutation, geometry below water plane is clipped
+layout(constant_id = 0) const bool ClipPlane = false;
+layout(constant_id = 22) const float ClipHeight = 10.0;    // Specialized from App::WaterLevel
+layout(constant_id = 23) const int NormalGrid = 64;         // Specialized from Terrain::NormalGrid
 
-layout(location = 0) in vec2 inPosition;
+layout(binding = 1) uniform usampler2D pageTable;   // Atlas slot | resident mip << 16
+layout(binding = 5) uniform sampler2D pageAtlas;
+
+const int PageSize = 64;
+const int PageStride = PageSize + 1;
 
 layout(location = 0) out vec3 fragPos;
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec2 fragTerCoord;
 layout(location = 3) out float fragHeight;
+layout(location = 4) flat out ivec3 fragNormalSlot;     // Atlas position of normal page slot, resident mip
+layout(location = 5) out vec2 fragNormalPos;            // Position in resident normal page, texels of its mip
+
+// Depth prepass and color pass must produce identical depth
+invariant gl_Position;
 
 vec2 morphVertex(vec2 gridpos, float morph)
 {
@@ -32,12 +48,80 @@ vec2 morphVertex(vec2 gridpos, float morph)
 	return gridpos - fracPart * morph;
 }
 
+// Point sample of heightmap through page table, missing page falls back to closest resident ancestor
+float sampleHeight(vec2 coord)
+{
+    uint entry = texelFetch(pageTable, ivec2(params.entry & 0xffffu, params.entry >> 16), 0).r;
+    int slot = int(entry & 0xffffu);
+    int mip = int(entry >> 16);
+
+    int texels = textureSize(pageTable, 0).y * PageSize;
+    ivec2 texel = ivec2(round(coord * float(texels)));
+
+    // Origin of resident page in its own mip, page is taken from tile so that far edge stays in it
+    ivec2 page = ivec2(params.page & 0xffffu, params.page >> 16);
+    ivec2 origin = (((page * PageSize) << params.mip) >> mip) / PageSize * PageSize;
+
+    int atlasPages = textureSize(pageAtlas, 0).x / PageStride;
+    ivec2 slotPos = ivec2(slot % atlasPages, slot / atlasPages) * PageStride;
+
+    return texelFetch(pageAtlas, slotPos + (texel >> mip) - origin, 0).r;
+}
+
+// Normal page of Terrain::normalPage through page table, tile holds NormalGrid texels of its mip unless
+// heightmap has fewer. Tile center picks the page, as tile edges may lie on page borders.
+ivec3 normalSlot(out ivec2 origin)
+{
+    int mip = max(int(params.mip) + findLSB(params.grid) - findLSB(NormalGrid), 0);
+
+    // Mips are packed side by side in page table, each at least one page wide
+    int tablePages = textureSize(pageTable, 0).y;
+    int column = 0;
+
+    for (int m = 0; m < mip; m++) column += max(tablePages >> m, 1);
+
+    vec2 center = (params.modelMat * vec4(0.0, 0.0, 0.0, 1.0)).xz / params.size + 0.5;
+    ivec2 page = ivec2(center * float(tablePages * PageSize)) / (PageSize << mip);
+
+    uint entry = texelFetch(pageTable, ivec2(column + page.x, page.y), 0).r;
+    int slot = int(entry & 0xffffu);
+    int resident = int(entry >> 16);
+
+    origin = (((page * PageSize) << mip) >> resident) / PageSize * PageSize;
+
+    int atlasPages = textureSize(pageAtlas, 0).x / PageStride;
+
+    return ivec3(ivec2(slot % atlasPages, slot / atlasPages) * PageStride, resident);
+}
+
+// Moves edge vertex onto the coarser spacing shared with neighbor tile
+float snapEdge(float pos, float halfGrid, uint edge, out float morphUnit)
+{
+    float snap = float(pos < 0.0 ? edge & 0xffu : (edge >> 8) & 0xffu);
+    morphUnit = (edge & 0x10000u) != 0u ? snap : 1.0;
+
+    return floor((pos + halfGrid) / snap) * snap - halfGrid;
+}
+
 void main() 
 {
-    vec4 tpos = vec4(inPosition.x, 0, inPosition.y, 1.0);
+    // Index value encodes grid vertex, centered around tile origin
+    int stride = int(params.grid) + 1;
+    float grid = float(params.grid);
+    float halfGrid = grid * 0.5;
+    vec2 inPosition = vec2(gl_VertexIndex % stride, gl_VertexIndex / stride) - halfGrid;
+
+    float morphUnit = 1.0;
+
+    if (inPosition.x == -halfGrid) inPosition.y = snapEdge(inPosition.y, halfGrid, params.edges.x, morphUnit);
+    else if (inPosition.x == halfGrid) inPosition.y = snapEdge(inPosition.y, halfGrid, params.edges.y, morphUnit);
+    else if (inPosition.y == -halfGrid) inPosition.x = snapEdge(inPosition.x, halfGrid, params.edges.z, morphUnit);
+    else if (inPosition.y == halfGrid) inPosition.x = snapEdge(inPosition.x, halfGrid, params.edges.w, morphUnit);
+
+    vec4 tpos = vec4(inPosition.x / grid, 0, inPosition.y / grid, 1.0);
     vec2 testcoord = ((params.modelMat*tpos).xz)/params.size + 0.5;
 
-    float h = textureLod(heightmap, testcoord, 0.0).r;
+    float h = sampleHeight(testcoord);
     tpos.y = h * params.hscale;
 
     vec4 testpos = params.modelMat*tpos;
@@ -46,12 +130,12 @@ void main()
     float morph = (dist - params.loddist) / params.loddist;
     morph = clamp(morph / 0.5 - 1.0, 0.0, 1.0);
 
-    vec2 mpos = morphVertex(inPosition, morph);
-    vec4 pos = vec4(mpos.x, 0, mpos.y, 1.0);
+    vec2 mpos = morphVertex(inPosition / morphUnit, morph) * morphUnit;
+    vec4 pos = vec4(mpos.x / grid, 0, mpos.y / grid, 1.0);
 
     vec2 ter_coord = ((params.modelMat*pos).xz)/params.size + 0.5;
 
-    h = textureLod(heightmap, ter_coord, 0.0).r;
+    h = sampleHeight(ter_coord);
     pos.y = h * params.hscale;
 
     vec4 world_pos = params.modelMat * pos;
@@ -62,5 +146,10 @@ void main()
     fragTerCoord = ter_coord;
     fragHeight = pos.y;
 
-    gl_ClipDistance[0] = params.clip == 1 ? pos.y - 9.2 : 1.0;
+    // Linear in terrain coordinate, so interpolation stays exact
+    ivec2 origin;
+    fragNormalSlot = normalSlot(origin);
+    fragNormalPos = ter_coord * float(textureSize(pageTable, 0).y * PageSize) / float(1 << fragNormalSlot.z) - vec2(origin);
+
+    gl_ClipDistance[0] = ClipPlane ? pos.y - ClipHeight : 1.0;
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(push_constant, std430) uniform constants
+{
+    float size;
+    layout(offset = 4) float hscale;
+    layout(offset = 12) float patchSize;
+    layout(offset = 16) vec2 origin;
+    layout(offset = 24) uint patches;
+    layout(offset = 28) float screenScale;
+
+} params;
+
+layout(binding = 1) uniform sampler2D heightmap;
+
+layout(location = 0) out vec3 outPos;
+
+void main() 
+{
+    // Four control points per patch, patches cover tile row by row
+    uint patch_id = gl_VertexIndex / 4;
+    uint corner = gl_VertexIndex % 4;
+
+    vec2 cell = vec2(patch_id % params.patches, patch_id / params.patches) + vec2(corner & 1, corner >> 1);
+    vec2 pos = params.origin + cell * params.patchSize;
+
+    float h = textureLod(heightmap, pos / params.size + 0.5, 0.0).r;
+
+    outPos = vec3(pos.x, h * params.hscale, pos.y);
+}
@@ -1,29 +1,46 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 layout(location = 0) in vec2 tcoord;
 layout(location = 1) in vec3 view_vec;
+layout(location = 2) in vec3 surface_pos;
+
+layout(binding = 0) uniform UniformBufferObject 
+{
+    mat4 proj;
+    vec3 pos;
+    mat3 viewmat;
+    float znear;
+    float zfar;
+} view;
 
 layout(push_constant) uniform constants
 {
-   layout(offset = 4) bool reflection;
-   layout(offset = 8) uint width;
-   layout(offset = 12) uint height;
+   layout(offset = 24) uint width;
+   layout(offset = 28) uint height;
+   layout(offset = 32) uint waves;      // texture table slot of current wave normal map
 } params;
 
+// Permutations: camera above water, screen-space reflection instead of planar reflection texture
+layout(constant_id = 0) const bool Reflection = false;
+layout(constant_id = 1) const bool ScreenSpace = false;
+
 layout(binding = 1) uniform sampler2D depth;
 layout(binding = 2) uniform sampler2D background;
 layout(binding = 3) uniform sampler2D reflection;
-layout(binding = 4) uniform sampler2D normal;
 
-layout(location = 0) out vec4 outColor;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
-float FresnelSchlick(float cosv)
+layout(binding = 5) uniform WaterBufferObject
 {
-    const float R0 = 0.02; // Refraction indices: 1.333 - water, 1 - air
+    mat4 reflViewProj[2];   // left/right image half
+    vec4 skyColor;
+} water;
 
-    return R0 + (1.0 - R0) * pow(1.0 - cosv, 5.0);
-}
+layout(location = 0) out vec4 outColor;
+
+#include "water.glsl"
 
 void main() 
 {
@@ -33,16 +50,28 @@ void main()
 
     vec3 v = normalize(-view_vec);
 
-    vec3 normal = texture(normal, tcoord).xyz * 2.0 - 1.0;
+    vec3 normal = unpackNormal(texture(textures[params.waves], tcoord).xy);
     vec2 dist_coord = clamp(gl_FragCoord.xy + normal.xy * 20.0, vec2(0, 0), vec2(params.width - 1, params.height - 1));
 
     vec3 bgcolor = texelFetch(background, ivec2(dist_coord), 0).xyz;
-    vec3 rcolor = texelFetch(reflection, ivec2(dist_coord), 0).xyz;
 
-    if (params.reflection)
+    if (Reflection)
     {
         vec3 norm = vec3(normal.x, normal.z * 50.0, normal.y);
         norm = normalize(norm);
+
+        vec3 rcolor;
+
+        if (ScreenSpace)
+        {
+            rcolor = traceReflection(surface_pos, reflect(-v, norm), background);
+        }
+        else
+        {
+            vec2 refl_coord = clamp(reflectionCoord(surface_pos) + normal.xy * 20.0, vec2(0, 0), vec2(params.width - 1, params.height - 1));
+            rcolor = texelFetch(reflection, ivec2(refl_coord), 0).xyz;
+        }
+
         float cosv = clamp(dot(v, norm), 0.0, 1.0);
         float factor = FresnelSchlick(cosv);
         vec3 color = mix(bgcolor, rcolor, factor);
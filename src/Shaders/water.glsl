@@ -0,0 +1,106 @@
+// Water surface shading shared by water.frag and water_composite.frag. Includer declares view and
+// water uniform blocks, params.width and params.height push constants and depth sampler.
+
+#include "common.glsl"
+
+float FresnelSchlick(float cosv)
+{
+    const float R0 = 0.02; // Refraction indices: 1.333 - water, 1 - air
+
+    return R0 + (1.0 - R0) * pow(1.0 - cosv, 5.0);
+}
+
+float getLinearDepth(float depth)
+{
+    const float near = view.znear;
+    const float far = view.zfar;
+
+    return near * far / (far + depth * (near - far));
+}
+
+vec2 screenCoord(vec4 clip)
+{
+    vec2 ndc = clip.xy / clip.w;
+    return vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5) * vec2(params.width, params.height);
+}
+
+vec2 projectReflection(mat4 viewProj, vec3 pos)
+{
+    return screenCoord(viewProj * vec4(pos, 1.0));
+}
+
+bool insideScreen(vec2 coord)
+{
+    return all(greaterThanEqual(coord, vec2(0.0))) && all(lessThan(coord, vec2(params.width, params.height)));
+}
+
+// Reflection may be older than current frame, so reproject surface point
+// with reflected view-projection it was rendered with
+vec2 reflectionCoord(vec3 pos)
+{
+    float half_width = params.width * 0.5;
+
+    vec2 coord = projectReflection(water.reflViewProj[0], pos);
+    if (coord.x < half_width) return coord;
+
+    return projectReflection(water.reflViewProj[1], pos);
+}
+
+// March reflected ray through main depth buffer, hit color is taken from opaque scene. Steps grow
+// geometrically so that the last one reaches far plane, step length stays proportional to distance.
+vec3 traceReflection(vec3 origin, vec3 dir, sampler2D scene)
+{
+    const int Steps = 48;
+    const int RefineSteps = 6;
+    const float FirstStep = 0.5;
+    const float Thickness = 2.0;
+
+    float stepGrowth = pow(view.zfar / FirstStep, 1.0 / float(Steps - 1));
+
+    float tprev = 0.0;
+    float t = FirstStep;
+
+    for (int i = 0; i < Steps; i++)
+    {
+        vec4 clip = view.proj * vec4(origin + dir * t, 1.0);
+        if (clip.w < view.znear || clip.w > view.zfar) break;
+
+        vec2 coord = screenCoord(clip);
+        if (!insideScreen(coord)) break;
+
+        float scene_depth = getLinearDepth(texelFetch(depth, ivec2(coord), 0).r);
+
+        if (clip.w > scene_depth && clip.w - scene_depth < Thickness * t)
+        {
+            // Binary search between last two samples
+            float tmin = tprev;
+            float tmax = t;
+
+            for (int k = 0; k < RefineSteps; k++)
+            {
+                float tmid = (tmin + tmax) * 0.5;
+
+                clip = view.proj * vec4(origin + dir * tmid, 1.0);
+                coord = screenCoord(clip);
+                scene_depth = getLinearDepth(texelFetch(depth, ivec2(coord), 0).r);
+
+                if (clip.w > scene_depth) tmax = tmid;
+                else tmin = tmid;
+            }
+
+            clip = view.proj * vec4(origin + dir * tmax, 1.0);
+            coord = clamp(screenCoord(clip), vec2(0, 0), vec2(params.width - 1, params.height - 1));
+
+            // Fade out near screen border to hide the missing data
+            vec2 edge = min(coord, vec2(params.width, params.height) - coord) / (0.1 * vec2(params.width, params.height));
+            float fade = clamp(min(edge.x, edge.y), 0.0, 1.0);
+
+            return mix(water.skyColor.xyz, texelFetch(scene, ivec2(coord), 0).xyz, fade);
+        }
+
+        tprev = t;
+        t *= stepGrowth;
+    }
+
+    return water.skyColor.xyz;
+}
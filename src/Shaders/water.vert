@@ -7,27 +7,30 @@ layout(binding = 0) uniform UniformBufferObject
     vec3 pos;
 } view;
 
-const vec2 quad[4] = vec2[4]( vec2(-1.0f, 1.0f),
+const vec2 quad[4] = vec2[4]( vec2(0.0f, 1.0f),
                               vec2(1.0f, 1.0f),
-                              vec2(-1.0f, -1.0f),
-                              vec2(1.0f, -1.0f) );
+                              vec2(0.0f, 0.0f),
+                              vec2(1.0f, 0.0f) );
 
 layout(push_constant) uniform constants
 {
+    vec4 tile;      // xz min, xz max
     float level;
 } params;
 
 layout(location = 0) out vec2 tcoord;
 layout(location = 1) out vec3 view_vec;
+layout(location = 2) out vec3 surface_pos;
 
-const float size = 3000;
 const float tex_scale = 0.125; 
 
 void main() 
 {
-    vec4 world_pos = vec4(quad[gl_VertexIndex].x * size + view.pos.x, 10.0, quad[gl_VertexIndex].y * size + view.pos.z, 1.0);
+    vec2 xz = mix(params.tile.xy, params.tile.zw, quad[gl_VertexIndex]);
+    vec4 world_pos = vec4(xz.x, params.level, xz.y, 1.0);
     gl_Position = view.proj * world_pos;
 
     tcoord = world_pos.xz * tex_scale;
     view_vec = world_pos.xyz - view.pos;
+    surface_pos = world_pos.xyz;
 }
\ No newline at end of file
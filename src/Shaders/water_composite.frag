@@ -0,0 +1,128 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+// Single full-screen pass combining underwater fog, refraction and reflection.
+// Scene depth is read once per pixel and shared by fog and water surface test.
+
+layout(binding = 0) uniform UniformBufferObject 
+{
+    mat4 proj;
+    vec3 pos;
+    mat3 viewmat;
+    float znear;
+    float zfar;
+} view;
+
+layout(push_constant) uniform constants
+{
+   vec3 color;              // fog color
+   float density;
+   float level;
+   layout(offset = 24) uint width;
+   layout(offset = 28) uint height;
+   layout(offset = 32) uint waves;      // texture table slot of current wave normal map
+   layout(offset = 36) float extent;    // water surface half size around camera
+} params;
+
+// Permutations: camera above water, screen-space reflection instead of planar reflection texture
+layout(constant_id = 0) const bool Reflection = false;
+layout(constant_id = 1) const bool ScreenSpace = false;
+
+layout(binding = 1) uniform sampler2D depth;
+layout(binding = 2) uniform sampler2D scene;
+layout(binding = 3) uniform sampler2D reflection;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+layout(binding = 5) uniform WaterBufferObject
+{
+    mat4 reflViewProj[2];   // left/right image half
+    vec4 skyColor;
+} water;
+
+layout(location = 0) out vec4 outColor;
+
+const float tex_scale = 0.125;
+
+#include "water.glsl"
+
+void main() 
+{
+    const float near = view.znear;
+    const float far = view.zfar;
+
+    const float h = params.level;
+
+    float d = texelFetch(depth, ivec2(gl_FragCoord.xy), 0).r;
+    float depth = getLinearDepth(d);
+
+    vec3 view_vec = view.viewmat * vec3(gl_FragCoord.xy + 0.5, 1.0);
+    float rlen = 1.0/length(view_vec);
+    vec3 dir = view_vec * rlen;
+
+    bool above = view.pos.y > h;
+
+    // Underwater fog, same as fog pass
+    float fog_alpha = 0.0;
+
+    if (dir.y <= -0.0001 || !above)
+    {
+        float dist = (view.pos.y - h) / -dir.y;
+        dist *= rlen;
+
+        dist = above ? max(near, dist) : dir.y < 0 ? far : dist;
+
+        float tmin = above ? max(near, dist) : min(near, depth);
+        float tmax = above ? max(dist, depth) : min(depth, dist);
+
+        fog_alpha = 1.0 - exp(-max(0.0, tmax - tmin) * params.density);
+    }
+
+    vec3 color = mix(texelFetch(scene, ivec2(gl_FragCoord.xy), 0).xyz, params.color, fog_alpha);
+
+    // Water surface intersection
+    float plane_t = (h - view.pos.y) / (abs(dir.y) > 0.0001 ? dir.y : 0.0001);
+    vec3 surface_pos = view.pos + dir * max(plane_t, 0.0);
+
+    vec3 normal = unpackNormal(texture(textures[params.waves], surface_pos.xz * tex_scale).xy);
+
+    bool surface = plane_t > 0.0 && plane_t * rlen < depth && 
+                   all(lessThan(abs(surface_pos.xz - view.pos.xz), vec2(params.extent)));
+
+    if (surface)
+    {
+        vec3 v = -dir;
+
+        vec2 dist_coord = clamp(gl_FragCoord.xy + normal.xy * 20.0, vec2(0, 0), vec2(params.width - 1, params.height - 1));
+
+        // Refracted pixel shares fog of this pixel instead of reading its own depth
+        vec3 bgcolor = mix(texelFetch(scene, ivec2(dist_coord), 0).xyz, params.color, fog_alpha);
+
+        if (Reflection)
+        {
+            vec3 norm = vec3(normal.x, normal.z * 50.0, normal.y);
+            norm = normalize(norm);
+
+            vec3 rcolor;
+
+            if (ScreenSpace)
+            {
+                rcolor = traceReflection(surface_pos, reflect(-v, norm), scene);
+            }
+            else
+            {
+                vec2 refl_coord = clamp(reflectionCoord(surface_pos) + normal.xy * 20.0, vec2(0, 0), vec2(params.width - 1, params.height - 1));
+                rcolor = texelFetch(reflection, ivec2(refl_coord), 0).xyz;
+            }
+
+            float cosv = clamp(dot(v, norm), 0.0, 1.0);
+            float factor = FresnelSchlick(cosv);
+            color = mix(bgcolor, rcolor, factor);
+        }
+        else
+            color = bgcolor;
+    }
+
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Water surface only marks stencil, color writes are disabled
+
+layout(location = 0) out vec4 outColor;
+
+void main() 
+{
+    outColor = vec4(0.0);
+}
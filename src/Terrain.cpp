@@ -4,58 +4,225 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Terrain.h"
+#include "Timeline.h"
 
 #include <algorithm>
+#include <iterator>
+#include <utility>
+#include <cassert>
+#include <bit>
+#include <iostream>
 
-Terrain::Terrain()
+Terrain::Terrain(NormalFormat normalFormat)
 : m_size(64)
 , m_maxLevel(4)
 {
     initGeometry();
 
-    m_dataSource.load("heightmaps/islands.png", 2.0);
+    // Coarse copy is drawn from the first frame, full resolution data is built on loader thread.
+    // Uncooked source is decoded here once and handed over.
+    std::unique_ptr<Image> decoded;
 
-    m_size = m_dataSource.size() / 2;
-    m_maxLevel = m_dataSource.levels();
+    {
+        StartupPhase phase("coarse terrain");
+
+        m_dataSource = std::make_unique<TerrainData>();
+        m_dataSource->load(HeightmapFile, HeightmapScale, normalFormat, CoarseSize, decoded);
+
+        initData();
+    }
 
-    float scale = m_size / (1 << m_maxLevel) / TileParams::GridSize;
+    m_loader = std::thread(&Terrain::loaderThread, this, normalFormat, std::move(decoded));
 }
 
-void Terrain::initGeometry()
+Terrain::~Terrain()
 {
-    std::vector<glm::vec2> vertices(TileParams::VertexNum);
+    // Loader gives up at its next stage, quitting during startup does not wait for full data
+    m_cancel = true;
 
-    constexpr size_t stride = TileParams::GridSize + 1;
+    if (m_loader.joinable()) m_loader.join();
+}
 
-    for (int k = 0; k <= TileParams::GridSize; k++)
-        for (int i = 0; i <= TileParams::GridSize; i++)
-        {
-            size_t idx = k * stride + i;
-            vertices[idx] = { i - int(TileParams::GridSize / 2), k - int(TileParams::GridSize / 2) };
-        }
+void Terrain::initData()
+{
+    m_size = m_dataSource->worldSize();
+    m_maxLevel = m_dataSource->levels();
 
-    std::vector<uint16_t> indices(TileParams::IndexNum);
+    // Coarsest mip matches smallest tile grid on root tile
+    uint32_t mips = uint32_t(std::countr_zero(m_dataSource->size() / TileGridSizes[0])) + 1;
+    m_virtualHeightmap = std::make_unique<VirtualHeightmap>(m_dataSource->heightmap(), mips, m_dataSource->normalFormat(), m_dataSource->slopeScale());
+}
 
-    size_t p = 0;
+void Terrain::loaderThread(NormalFormat normalFormat, std::unique_ptr<Image> decoded)
+{
+    StartupPhase phase("full terrain load");
 
-    for (uint16_t k = 0; k < TileParams::GridSize; k++)
-        for (uint16_t i = 0; i < TileParams::GridSize; i++)
-        {
-            uint16_t v = i * stride + k;
+    try
+    {
+        auto data = std::make_unique<TerrainData>();
 
-            //
-            indices[p++] = v;
-            indices[p++] = v + 1;
-            indices[p++] = v + stride;
+        if (data->load(HeightmapFile, HeightmapScale, normalFormat, 0, decoded, &m_cancel)) m_fullData = std::move(data);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Terrain: " << e.what() << ", coarse data is kept" << std::endl;
+    }
 
-            //
-            indices[p++] = v + stride;
-            indices[p++] = v + 1;
-            indices[p++] = v + stride + 1;
-        }
+    m_fullReady = true;
+}
+
+bool Terrain::update()
+{
+    if (!m_fullReady || !m_loader.joinable()) return false;
+
+    m_loader.join();
+
+    if (!m_fullData) return false;
+
+    StartupPhase phase("full terrain swap");
+
+    // Coarse textures and pages may still be read by submitted frames
+    Render::VulkanInstance::GetInstance().waitIdle();
+
+    if (m_dataSource->texturesResident()) m_fullData->uploadTextures();
+
+    m_dataLock.lock();
+
+    // Page loader of old virtual heightmap reads old data, it goes first
+    m_virtualHeightmap.reset();
+    m_dataSource = std::move(m_fullData);
+    m_tiles.clear();
+
+    initData();
+
+    m_dataLock.unlock();
+
+    return true;
+}
+
+size_t Terrain::normalFetchBytes() const
+{
+    // Derived normals take four heightmap taps, CDLOD normal pages have the format of normal texture
+    const Image& normals = m_dataSource->normals();
+    return pixelsize(normals.format) * (normalFormat() == NormalFormat::Derived ? 4 : 1);
+}
+
+void Terrain::setFragmentConstants(Render::CommandList& commandList) const
+{
+    commandList.setConstant(112, uint32_t(normalFormat()), VK_SHADER_STAGE_FRAGMENT_BIT);
+    commandList.setConstant(116, m_dataSource->slopeScale(), VK_SHADER_STAGE_FRAGMENT_BIT);
+    commandList.setConstant(120, m_diffuseSlots, VK_SHADER_STAGE_FRAGMENT_BIT);
+    commandList.setConstant(124, m_normalSlots, VK_SHADER_STAGE_FRAGMENT_BIT);
+}
+
+static uint32_t compactBits(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0f0f0f0f;
+    v = (v | (v >> 4)) & 0x00ff00ff;
+    v = (v | (v >> 8)) & 0x0000ffff;
+
+    return v;
+}
+
+template<size_t Grid>
+static void appendTileIndices(std::vector<uint16_t>& indices, TileIndexOrder order)
+{
+    // Vertex (i, k) of the grid has index k * stride + i
+    constexpr size_t stride = TileParams<Grid>::GridSize + 1;
+
+    for (uint32_t q = 0; q < Grid * Grid; q++)
+    {
+        uint32_t i = order == TileIndexOrder::Morton ? compactBits(q) : q % Grid;
+        uint32_t k = order == TileIndexOrder::Morton ? compactBits(q >> 1) : q / Grid;
+
+        uint16_t v = uint16_t(k * stride + i);
+
+        //
+        indices.push_back(v);
+        indices.push_back(v + 1);
+        indices.push_back(v + stride);
+
+        //
+        indices.push_back(v + stride);
+        indices.push_back(v + 1);
+        indices.push_back(v + stride + 1);
+    }
+}
+
+void Terrain::initGeometry()
+{
+    std::vector<uint16_t> indices;
+    std::vector<uint16_t> mortonIndices;
+
+    // All grid resolutions share one index buffer, each order has identical mesh ranges
+    auto appendMesh = [&]<size_t Grid>(size_t n)
+    {
+        m_tileMeshes[n] = { uint32_t(indices.size()), uint32_t(TileParams<Grid>::IndexNum) };
+
+        appendTileIndices<Grid>(indices, TileIndexOrder::Linear);
+        appendTileIndices<Grid>(mortonIndices, TileIndexOrder::Morton);
+    };
+
+    [&]<size_t... N>(std::index_sequence<N...>)
+    {
+        (appendMesh.template operator()<TileGridSizes[N]>(N), ...);
+    }(std::make_index_sequence<TileGridNum>());
 
-    m_vertexBuffer.setData(vertices.data(), vertices.size());
     m_indexBuffer.setData(indices.data(), indices.size());
+    m_mortonIndexBuffer.setData(mortonIndices.data(), mortonIndices.size());
+}
+
+const TileMesh& Terrain::tileMesh(uint32_t grid) const
+{
+    size_t n = std::find(std::begin(TileGridSizes), std::end(TileGridSizes), grid) - std::begin(TileGridSizes);
+
+    assert(n < TileGridNum);
+
+    return m_tileMeshes[n];
+}
+
+PageKey Terrain::tilePage(const TileKey& tilekey, uint32_t grid) const
+{
+    // Tile covers grid texels of its mip, grids divide page size so tiles never straddle pages
+    uint32_t mip = uint32_t(std::countr_zero(TileParams<>::GridSize << (m_maxLevel - tilekey.level)) - std::countr_zero(grid));
+    uint32_t tilesPerPage = VirtualHeightmap::PageSize / grid;
+
+    return { mip, tilekey.x / tilesPerPage, tilekey.y / tilesPerPage };
+}
+
+PageKey Terrain::normalPage(const TileKey& tilekey) const
+{
+    uint32_t maxGrid = TileParams<>::GridSize << (m_maxLevel - tilekey.level);
+
+    return tilePage(tilekey, std::min(NormalGrid, maxGrid));
+}
+
+uint32_t Terrain::chooseGrid(const TileKey& tilekey) const
+{
+    uint32_t tnum = 1 << tilekey.level;
+    float spacing = m_size / tnum / TileParams<>::GridSize;
+
+    // No point in more vertices than heightmap texels
+    uint32_t maxGrid = TileParams<>::GridSize << (m_maxLevel - tilekey.level);
+
+    // Interpolation error falls with square of vertex spacing
+    float error = m_dataSource->getTileRoughness(tilekey) / (spacing * GridErrorTolerance);
+
+    uint32_t grid = TileGridSizes[0];
+
+    for (size_t g : TileGridSizes)
+    {
+        if (g > maxGrid) break;
+
+        grid = uint32_t(g);
+
+        float scale = float(TileParams<>::GridSize) / g;
+        if (error * scale * scale <= 1.0f) break;
+    }
+
+    return grid;
 }
 
 float Terrain::tileSize(uint32_t level)
@@ -66,7 +233,7 @@ float Terrain::tileSize(uint32_t level)
 
 BBox Terrain::getBBox(const TileKey& tilekey)
 {
-    const HeightRange& range = m_dataSource.getTileRange(tilekey);
+    const HeightRange& range = m_dataSource->getTileRange(tilekey);
 
     if (tilekey.level == 0)
     {
@@ -104,13 +271,13 @@ void Terrain::generateTile(const TileKey& tilekey)
     uint32_t tnum = 1 << tilekey.level;
     float tilesz = m_size / tnum;
 
-    float scale = tilesz / TileParams::GridSize;
-
-    glm::mat4 mat = glm::scale(glm::mat4(1.0f), glm::vec3(scale, 1.0f, scale));
+    // Grid resolution is applied in vertex shader, matrix maps unit tile
+    glm::mat4 mat = glm::scale(glm::mat4(1.0f), glm::vec3(tilesz, 1.0f, tilesz));
     mat = glm::translate(glm::mat4(1.0f), pos) * mat;
 
     tile.mat = mat;
     tile.lodDist = tileSize(tilekey.level);
+    tile.grid = chooseGrid(tilekey);
 }
 
 void Terrain::generateTiles(const std::vector<TileKey>& tiles)
@@ -134,9 +301,9 @@ void TerrainView::processTile(const TileKey& tilekey)
     uint32_t tnum = 1 << tilekey.level;
     float tilesz = m_terrain.size() / tnum;
 
-    if (tilekey.level == m_terrain.levels())
+    if (tilekey.level == m_terrain.selectionLevels())
     {
-        m_viewTiles.push_back(tilekey);
+        addViewTile(tilekey, bbox);
         return;
     }
 
@@ -155,15 +322,24 @@ void TerrainView::processTile(const TileKey& tilekey)
     }
     else
     {
-        m_viewTiles.push_back(tilekey);
+        addViewTile(tilekey, bbox);
     }
 }
 
+void TerrainView::addViewTile(const TileKey& tilekey, const BBox& bbox)
+{
+    glm::vec3 closest = glm::clamp(m_camera.pos(), bbox.min, bbox.max);
+
+    m_viewTiles.push_back(tilekey);
+    m_tileDistances.push_back(glm::length(closest - m_camera.pos()));
+}
+
 void TerrainView::update()
 {
     m_viewTiles.clear();
+    m_tileDistances.clear();
 
-    m_processQueue.push_back({ 0, 0, 0 });
+    if (m_terrain.lod() != TerrainLod::Clipmap) m_processQueue.push_back({ 0, 0, 0 });
 
     while (!m_processQueue.empty())
     {
@@ -173,24 +349,261 @@ void TerrainView::update()
         processTile(tilekey);
     }
 
+    // Front to back order lets early depth test reject hidden terrain fragments
+    if (m_sortTiles)
+    {
+        m_sortOrder.resize(m_viewTiles.size());
+
+        for (size_t i = 0; i < m_viewTiles.size(); i++) m_sortOrder[i] = { m_tileDistances[i], m_viewTiles[i] };
+
+        std::sort(m_sortOrder.begin(), m_sortOrder.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (size_t i = 0; i < m_viewTiles.size(); i++) m_viewTiles[i] = m_sortOrder[i].second;
+    }
+
     m_terrain.generateTiles(m_viewTiles);
+
+    updateEdges();
+
+    m_tilePages.resize(m_viewTiles.size());
+
+    for (size_t i = 0; i < m_viewTiles.size(); i++)
+    {
+        m_tilePages[i] = m_terrain.tilePage(m_viewTiles[i], m_tileGrids[i]);
+
+        // Fragment stage reads normals from a page of normal grid spacing, see terrain.vert
+        if (m_terrain.lod() == TerrainLod::CDLOD)
+        {
+            m_terrain.virtualHeightmap().request(m_tilePages[i]);
+            m_terrain.virtualHeightmap().request(m_terrain.normalPage(m_viewTiles[i]));
+        }
+    }
+}
+
+uint32_t TerrainView::edgeSnap(const TileKey& tilekey, uint32_t grid, int32_t dx, int32_t dy) const
+{
+    constexpr uint32_t SameLevel = 1 << 16;
+
+    int32_t tnum = 1 << tilekey.level;
+    int32_t nx = int32_t(tilekey.x) + dx;
+    int32_t ny = int32_t(tilekey.y) + dy;
+
+    if (nx < 0 || ny < 0 || nx >= tnum || ny >= tnum) return 1 | 1 << 8;
+
+    // Neighbor of same level, both sides snap to coarser grid and morph in snapped units
+    auto it = m_gridLookup.find({ tilekey.level, uint32_t(nx), uint32_t(ny) });
+
+    if (it != m_gridLookup.end())
+    {
+        uint32_t snap = std::max(grid / it->second, 1u);
+        return snap | snap << 8 | SameLevel;
+    }
+
+    // Coarser neighbor, this tile is fully morphed at the edge so spacing is at least two
+    if (tilekey.level > 0)
+    {
+        it = m_gridLookup.find({ tilekey.level - 1, uint32_t(nx) / 2, uint32_t(ny) / 2 });
+
+        if (it != m_gridLookup.end())
+        {
+            uint32_t snap = std::max(2 * grid / it->second, 2u);
+            return snap | snap << 8;
+        }
+    }
+
+    // Finer neighbors, each half of the edge matches its own child tile
+    uint32_t snap[2] = { 1, 1 };
+
+    for (uint32_t h = 0; h < 2; h++)
+    {
+        TileKey child = dx != 0 ? TileKey{ tilekey.level + 1, uint32_t(nx * 2 + (dx < 0)), uint32_t(ny * 2) + h }
+                                : TileKey{ tilekey.level + 1, uint32_t(nx * 2) + h, uint32_t(ny * 2 + (dy < 0)) };
+
+        it = m_gridLookup.find(child);
+
+        if (it != m_gridLookup.end()) snap[h] = std::max(grid / it->second, 1u);
+    }
+
+    return snap[0] | snap[1] << 8;
+}
+
+void TerrainView::updateEdges()
+{
+    m_gridLookup.clear();
+    m_tileGrids.resize(m_viewTiles.size());
+    m_tileEdges.resize(m_viewTiles.size());
+
+    for (size_t i = 0; i < m_viewTiles.size(); i++)
+    {
+        m_tileGrids[i] = m_terrain.tileGrid(m_terrain.tile(m_viewTiles[i]));
+        m_gridLookup[m_viewTiles[i]] = m_tileGrids[i];
+    }
+
+    // Edge vertices snap to the coarser spacing of the two sides (-x, +x, -z, +z)
+    for (size_t i = 0; i < m_viewTiles.size(); i++)
+    {
+        const TileKey& tilekey = m_viewTiles[i];
+        uint32_t grid = m_tileGrids[i];
+
+        m_tileEdges[i] = { edgeSnap(tilekey, grid, -1, 0), edgeSnap(tilekey, grid, 1, 0),
+                           edgeSnap(tilekey, grid, 0, -1), edgeSnap(tilekey, grid, 0, 1) };
+    }
+}
+
+void TerrainView::processWaterTile(const TileKey& tilekey, float level)
+{
+    BBox bbox = m_terrain.getBBox(tilekey);
+
+    if (bbox.min.y >= level) return;
+
+    BBox surface = { { bbox.min.x, level, bbox.min.z }, { bbox.max.x, level, bbox.max.z } };
+
+    if (!m_frustum.test(surface)) return;
+
+    uint32_t maxLevel = m_terrain.levels() > WaterTileLevels ? m_terrain.levels() - WaterTileLevels : 0;
+
+    if (bbox.max.y < level || tilekey.level >= maxLevel)
+    {
+        m_waterTiles.emplace_back(bbox.min.x, bbox.min.z, bbox.max.x, bbox.max.z);
+        return;
+    }
+
+    uint32_t childLevel = tilekey.level + 1;
+    uint32_t x = tilekey.x * 2;
+    uint32_t y = tilekey.y * 2;
+
+    processWaterTile({ childLevel, x, y }, level);
+    processWaterTile({ childLevel, x + 1, y }, level);
+    processWaterTile({ childLevel, x, y + 1 }, level);
+    processWaterTile({ childLevel, x + 1, y + 1 }, level);
+}
+
+void TerrainView::updateWater(float level, float extent)
+{
+    const glm::vec3& pos = m_camera.pos();
+
+    m_waterTiles.clear();
+    m_waterLevel = level;
+
+    // Underwater fog covers whole screen
+    m_underwater = pos.y <= level;
+
+    BBox water = { { pos.x - extent, level, pos.z - extent }, { pos.x + extent, level, pos.z + extent } };
+
+    if (!m_frustum.test(water)) return;
+
+    // Open water outside of terrain
+    float dim = m_terrain.size() * 0.5f;
+
+    BBox open[4] = { { water.min, { std::min(water.max.x, -dim), level, water.max.z } },
+                     { { std::max(water.min.x, dim), level, water.min.z }, water.max },
+                     { { std::max(water.min.x, -dim), level, water.min.z }, { std::min(water.max.x, dim), level, std::min(water.max.z, -dim) } },
+                     { { std::max(water.min.x, -dim), level, std::max(water.min.z, dim) }, { std::min(water.max.x, dim), level, water.max.z } } };
+
+    for (const BBox& bbox : open)
+    {
+        if (bbox.min.x >= bbox.max.x || bbox.min.z >= bbox.max.z) continue;
+        if (m_frustum.test(bbox)) m_waterTiles.emplace_back(bbox.min.x, bbox.min.z, bbox.max.x, bbox.max.z);
+    }
+
+    processWaterTile({ 0, 0, 0 }, level);
+}
+
+glm::vec4 TerrainView::waterScreenBounds(const glm::mat4& viewProj) const
+{
+    const float wmin = 1e-4f;
+
+    glm::vec2 bmin(1.0f);
+    glm::vec2 bmax(-1.0f);
+
+    for (const glm::vec4& tile : m_waterTiles)
+    {
+        glm::vec4 corners[4] = { viewProj * glm::vec4(tile.x, m_waterLevel, tile.y, 1.0f),
+                                 viewProj * glm::vec4(tile.z, m_waterLevel, tile.y, 1.0f),
+                                 viewProj * glm::vec4(tile.z, m_waterLevel, tile.w, 1.0f),
+                                 viewProj * glm::vec4(tile.x, m_waterLevel, tile.w, 1.0f) };
+
+        // Clip tile quad against plane in front of camera before projection
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            const glm::vec4& a = corners[i];
+            const glm::vec4& b = corners[(i + 1) % 4];
+
+            if (a.w > wmin)
+            {
+                bmin = glm::min(bmin, glm::vec2(a) / a.w);
+                bmax = glm::max(bmax, glm::vec2(a) / a.w);
+            }
+
+            if ((a.w > wmin) != (b.w > wmin))
+            {
+                glm::vec4 p = glm::mix(a, b, (wmin - a.w) / (b.w - a.w));
+
+                bmin = glm::min(bmin, glm::vec2(p) / p.w);
+                bmax = glm::max(bmax, glm::vec2(p) / p.w);
+            }
+        }
+    }
+
+    return glm::clamp(glm::vec4(bmin, bmax), -1.0f, 1.0f);
+}
+
+void TerrainView::displayWater(Render::CommandList& commandList) const
+{
+    for (const glm::vec4& tile : m_waterTiles)
+    {
+        commandList.setConstant(0, tile);
+        commandList.draw(4);
+    }
 }
 
 void TerrainView::display(Render::CommandList& commandList) const
 {
+    const VirtualHeightmap& heightmap = m_terrain.virtualHeightmap();
+
     commandList.bindIndexBuffer(m_terrain.tileIndexBuffer());
-    commandList.bindVertexBuffer(m_terrain.tileVertexBuffer());
 
     commandList.setConstant(0, m_terrain.size());
     commandList.setConstant(4, m_terrain.height());
+    m_terrain.setFragmentConstants(commandList);
 
-    for (const TileKey& tilekey : m_viewTiles)
+    for (size_t i = 0; i < m_viewTiles.size(); i++)
     {
-        const Tile& tile = m_terrain.tile(tilekey);
+        const Tile& tile = m_terrain.tile(m_viewTiles[i]);
+        const TileMesh& mesh = m_terrain.tileMesh(m_tileGrids[i]);
+        const PageKey& page = m_tilePages[i];
 
         commandList.setConstant(12, tile.lodDist);
         commandList.setConstant(16, tile.mat);
-        commandList.drawIndexed(TileParams::IndexNum);
+        commandList.setConstant(80, m_tileGrids[i]);
+        commandList.setConstant(84, page.mip);
+        commandList.setConstant(88, page.x | page.y << 16);
+        commandList.setConstant(92, heightmap.tableEntry(page));
+        commandList.setConstant(96, m_tileEdges[i]);
+        commandList.drawIndexed(mesh.count, mesh.first);
+    }
+}
+
+void TerrainView::displayPatches(Render::CommandList& commandList, float screenScale) const
+{
+    constexpr VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+
+    float patchSize = m_terrain.patchSize();
+
+    commandList.setConstant(0, m_terrain.size(), stages);
+    commandList.setConstant(4, m_terrain.height(), stages);
+    commandList.setConstant(12, patchSize, stages);
+    commandList.setConstant(28, screenScale, stages);
+    m_terrain.setFragmentConstants(commandList);
+
+    for (const TileKey& tilekey : m_viewTiles)
+    {
+        BBox bbox = m_terrain.getBBox(tilekey);
+        uint32_t patches = uint32_t((bbox.max.x - bbox.min.x) / patchSize);
+
+        commandList.setConstant(16, glm::vec2(bbox.min.x, bbox.min.z), stages);
+        commandList.setConstant(24, patches, stages);
+        commandList.draw(patches * patches * 4);
     }
 }
 
@@ -4,34 +4,107 @@
 #include "BBox.h"
 
 #include "TerrainData.h"
+#include "VirtualHeightmap.h"
 
 #include "Sync.h"
 
 #include <vector>
 #include <map>
 #include <deque>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+enum class TileIndexOrder
+{
+    Linear,     // Quads in grid order
+    Morton      // Quads in Z-order for better post-transform vertex cache reuse
+};
+
+enum class TerrainLod
+{
+    CDLOD,          // Quadtree down to leaf tiles, morphing in vertex shader
+    Tessellation,   // Shallow quadtree for culling, patches tessellated on GPU
+    Clipmap         // Camera centered rings, no tile selection
+};
 
 struct Tile
 {
-    glm::mat4 mat;
+    glm::mat4 mat;      // Unit tile to world
     float lodDist;
+    uint32_t grid;      // Grid resolution chosen from terrain roughness
+};
+
+// Range of tile mesh in index buffer
+struct TileMesh
+{
+    uint32_t first;
+    uint32_t count;
 };
 
 class Terrain
 {
 public:
-    Terrain();
+    Terrain(NormalFormat normalFormat = NormalFormat::RGBA8);
+    ~Terrain();
+
+    // Swaps coarse data for full resolution data once loader thread has built it, returns true when
+    // terrain images changed. Called between frames, no view update may run meanwhile.
+    bool update();
+    bool streaming() const { return !m_fullReady || m_loader.joinable(); }
 
-    const Image& heightmap() { return m_dataSource.heightmap(); }
-    const Image& normals() { return m_dataSource.normals(); }
+    const Image& heightmap() { return m_dataSource->heightmap(); }
+    const Image& normals() { return m_dataSource->normals(); }
+
+    // Full resolution textures of tessellation and clipmap paths, CDLOD runs without them
+    void uploadTextures() { m_dataSource->uploadTextures(); }
+    bool texturesResident() const { return m_dataSource->texturesResident(); }
+
+    NormalFormat normalFormat() const { return m_dataSource->normalFormat(); }
+    // Normal texture of tessellation and clipmap paths plus normal pages of CDLOD
+    size_t normalBytes() const { return m_dataSource->normalBytes() + m_virtualHeightmap->normalAtlasBytes(); }
+
+    // Texel data read per terrain fragment for geometry normals, before filtering and caches
+    size_t normalFetchBytes() const;
+
+    // Normal decoding constants and material slots of terrain.frag, shared by every LOD path
+    void setFragmentConstants(Render::CommandList& commandList) const;
+
+    // Texture table slots of grass, dirt and rock, 10 bits each
+    void setMaterials(uint32_t diffuseSlots, uint32_t normalSlots) { m_diffuseSlots = diffuseSlots; m_normalSlots = normalSlots; }
+
+    // CDLOD tiles sample heights through page table instead of full heightmap
+    VirtualHeightmap& virtualHeightmap() { return *m_virtualHeightmap; }
+
+    // Normal page texels per CDLOD tile side, fragment normals don't depend on tile mesh grid
+    static constexpr uint32_t NormalGrid = uint32_t(TileGridSizes[TileGridNum - 1]);
 
     uint32_t levels() const { return m_maxLevel; }
 
     float size() const { return m_size; }
-    float height() const { return m_dataSource.height(); }
+    float height() const { return m_dataSource->height(); }
+
+    void setIndexOrder(TileIndexOrder order) { m_indexOrder = order; }
+    TileIndexOrder indexOrder() const { return m_indexOrder; }
+
+    // Adaptive mode picks tile grid from roughness, otherwise all tiles use default grid
+    void setAdaptiveGrid(bool adaptive) { m_adaptiveGrid = adaptive; }
+    bool adaptiveGrid() const { return m_adaptiveGrid; }
+
+    void setLod(TerrainLod lod) { m_lod = lod; }
+    TerrainLod lod() const { return m_lod; }
+
+    // Deepest quadtree level visited by tile selection
+    uint32_t selectionLevels() const { return m_lod == TerrainLod::Tessellation ? m_maxLevel - std::min(m_maxLevel, TessLevels) : m_maxLevel; }
+
+    // Tessellation patches have the same world size everywhere so that shared edges match
+    float patchSize() const { return m_size / (1 << m_maxLevel) * 2.0f; }
 
 private:
     void initGeometry();
+    void initData();
+    void loaderThread(NormalFormat normalFormat, std::unique_ptr<Image> decoded);
 
     float tileSize(uint32_t level);
 
@@ -41,14 +114,39 @@ private:
 
     const Tile& tile(const TileKey& tilekey) const { return m_tiles.at(tilekey); }
 
-    VkBuffer tileIndexBuffer() const { return m_indexBuffer; }
-    VkBuffer tileVertexBuffer() const { return m_vertexBuffer; }
+    uint32_t tileGrid(const Tile& tile) const { return m_adaptiveGrid ? tile.grid : TileParams<>::GridSize; }
+    uint32_t chooseGrid(const TileKey& tilekey) const;
+    const TileMesh& tileMesh(uint32_t grid) const;
+
+    // Heightmap mip with texel spacing of tile grid, tile vertices stay within one page of it
+    PageKey tilePage(const TileKey& tilekey, uint32_t grid) const;
+    // Page of tile geometry normals, tiles with fewer heightmap texels than normal grid take the finest mip
+    PageKey normalPage(const TileKey& tilekey) const;
+
+    VkBuffer tileIndexBuffer() const { return m_indexOrder == TileIndexOrder::Morton ? m_mortonIndexBuffer : m_indexBuffer; }
 
 private:
-    TerrainData m_dataSource;
+    std::unique_ptr<TerrainData> m_dataSource;
+    std::unique_ptr<VirtualHeightmap> m_virtualHeightmap;
+
+    // Full resolution data, handed over by loader thread
+    std::unique_ptr<TerrainData> m_fullData;
+    std::atomic<bool> m_fullReady = false;
+    std::atomic<bool> m_cancel = false;
+    std::thread m_loader;
 
+    // Grid positions are derived from index values in vertex shader, no vertex buffer is needed
     Render::IndexBuffer m_indexBuffer;
-    Render::VertexBuffer<glm::vec2> m_vertexBuffer;
+    Render::IndexBuffer m_mortonIndexBuffer;
+    TileIndexOrder m_indexOrder = TileIndexOrder::Morton;
+
+    TileMesh m_tileMeshes[TileGridNum];
+    bool m_adaptiveGrid = true;
+
+    TerrainLod m_lod = TerrainLod::CDLOD;
+
+    uint32_t m_diffuseSlots = 0;
+    uint32_t m_normalSlots = 0;
 
     float m_size;
     uint32_t m_maxLevel;
@@ -57,6 +155,12 @@ private:
 
     SpinLock m_dataLock;
 
+    static constexpr float GridErrorTolerance = 0.05f;    // Allowed interpolation error relative to default grid spacing
+    static constexpr uint32_t TessLevels = 3;             // Quadtree levels replaced by tessellation
+
+    static constexpr const char* HeightmapFile = "heightmaps/islands.png";
+    static constexpr uint32_t CoarseSize = 512;           // Heightmap size of data drawn while full data loads
+
     friend class TerrainView;
 };
 
@@ -72,10 +176,30 @@ public:
 
     void update();
     void display(Render::CommandList& commandList) const;
+    void displayPatches(Render::CommandList& commandList, float screenScale) const;
+
+    void setSortTiles(bool sort) { m_sortTiles = sort; }
+
+    // Collects visible water surface tiles where terrain goes below given level
+    void updateWater(float level, float extent);
+    void displayWater(Render::CommandList& commandList) const;
+
+    bool waterVisible() const { return m_underwater || !m_waterTiles.empty(); }
+    bool underwater() const { return m_underwater; }
+
+    // Screen bounds of water tiles in NDC (xy min, xy max)
+    glm::vec4 waterScreenBounds(const glm::mat4& viewProj) const;
+    size_t waterTileCount() const { return m_waterTiles.size(); }
+
     void displayBBoxes(Render::CommandList& commandList) const;
 
 private:
     void processTile(const TileKey& tileKey);
+    void addViewTile(const TileKey& tilekey, const BBox& bbox);
+    void processWaterTile(const TileKey& tilekey, float level);
+
+    uint32_t edgeSnap(const TileKey& tilekey, uint32_t grid, int32_t dx, int32_t dy) const;
+    void updateEdges();
 
 private:
     Terrain& m_terrain;
@@ -85,4 +209,20 @@ private:
 
     std::deque<TileKey> m_processQueue;
     std::vector<TileKey> m_viewTiles;
+    std::vector<float> m_tileDistances;
+    std::vector<std::pair<float, TileKey>> m_sortOrder;
+    bool m_sortTiles = true;
+
+    // Per view tile grid and edge snapping, see updateEdges
+    std::vector<uint32_t> m_tileGrids;
+    std::vector<glm::uvec4> m_tileEdges;
+    std::map<TileKey, uint32_t> m_gridLookup;
+
+    std::vector<PageKey> m_tilePages;
+
+    std::vector<glm::vec4> m_waterTiles;    // xz min, xz max
+    bool m_underwater = false;
+    float m_waterLevel = 0.0f;
+
+    static constexpr uint32_t WaterTileLevels = 2;  // Water tiles stop this many levels above terrain leaves
 };
\ No newline at end of file
@@ -1,8 +1,16 @@
 #include "TerrainData.h"
 #include "Render/Render.h"
+#include "Parallel.h"
+#include "Timeline.h"
+#include "Resources/Tex.h"
 
 #include <random>
 #include <numeric>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <stdexcept>
 
 constexpr float ipow(float a, int p)
 {
@@ -28,11 +36,12 @@ void TerrainData::generateData(uint32_t size, float scale)
     m_heightmap->mipmaps = 1;
     size_t dataSize = width * height * sizeof(uint32_t);
 
-    Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
-    uint32_t* heightmap = reinterpret_cast<uint32_t*>(buffer.map(dataSize));
+    TextureData texture;
+    texture.data.resize(dataSize);
+    uint32_t* heightmap = reinterpret_cast<uint32_t*>(texture.data.data());
 
     m_size = size;
-    m_levels = uint32_t(log2f(m_size)) - log2f(TileParams::GridSize);
+    m_levels = uint32_t(log2f(m_size)) - log2f(TileParams<>::GridSize);
     m_scale = scale;
 
     m_data.resize((size + 1) * (size + 1));
@@ -79,75 +88,289 @@ void TerrainData::generateData(uint32_t size, float scale)
             heightmap[ind] = value(i / 16.0f, k / 16.0f);
         }
 
-    buffer.unmap();
-
-    Render::VulkanInstance::GetInstance().createTexture(buffer, *m_heightmap);
+    texture.regions = LevelRegions(*m_heightmap, 1);
+    m_uploads.push_back({ m_heightmap.get(), std::move(texture) });
 
     buildNormals();
     buildLayers();
     generateTiles();
+
+    uploadTextures();
 }
 
-void TerrainData::buildNormals()
+// Texel count of full mip chain, levels are stored one after another
+static size_t mipChainTexels(uint32_t width, uint32_t height, size_t mipmaps)
+{
+    size_t texels = 0;
+
+    for (size_t i = 0; i < mipmaps; i++)
+    {
+        texels += size_t(width) * height;
+
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+
+    return texels;
+}
+
+// Builds every level from the previous one, filter(in, inWidth, inHeight, x, y) returns texel (x, y) of next level
+template<class T, class Filter>
+static void buildMipChain(T* data, uint32_t width, uint32_t height, size_t mipmaps, Filter filter)
+{
+    for (size_t i = 1; i < mipmaps; i++)
+    {
+        T* out = data + size_t(width) * height;
+
+        uint32_t outWidth = std::max(width / 2, 1u);
+        uint32_t outHeight = std::max(height / 2, 1u);
+
+        ParallelFor(0, outHeight, [&](uint32_t y)
+        {
+            for (uint32_t x = 0; x < outWidth; x++) out[y * outWidth + x] = filter(data, width, height, x, y);
+        });
+
+        data = out;
+        width = outWidth;
+        height = outHeight;
+    }
+}
+
+// Footprint of next level texel (x, y) clamped to source level
+template<class T>
+static std::array<T, 4> mipFootprint(const T* in, uint32_t width, uint32_t height, uint32_t x, uint32_t y)
+{
+    uint32_t x0 = std::min(x * 2, width - 1);
+    uint32_t x1 = std::min(x * 2 + 1, width - 1);
+    uint32_t y0 = std::min(y * 2, height - 1);
+    uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+    return { in[y0 * width + x0], in[y0 * width + x1], in[y1 * width + x0], in[y1 * width + x1] };
+}
+
+// Average stays within range of source texels, so tile height ranges remain conservative for every level
+static uint16_t averageHeights(const uint16_t* in, uint32_t width, uint32_t height, uint32_t x, uint32_t y)
+{
+    std::array<uint16_t, 4> t = mipFootprint(in, width, height, x, y);
+    return uint16_t((uint32_t(t[0]) + t[1] + t[2] + t[3] + 2) / 4);
+}
+
+void TerrainData::downsampleHeights(const Image& source, uint32_t levels)
+{
+    uint32_t width = source.width;
+    uint32_t height = source.height;
+
+    std::vector<uint16_t> heights(mipChainTexels(width, height, levels + 1));
+    memcpy(heights.data(), source.data, size_t(width) * height * sizeof(uint16_t));
+
+    buildMipChain(heights.data(), width, height, levels + 1, averageHeights);
+
+    // Last level built is first level of heightmap, decoded source stays intact
+    const uint16_t* level = heights.data() + mipChainTexels(width, height, levels);
+
+    m_heightmap->format = source.format;
+    m_heightmap->width = std::max(width >> levels, 1u);
+    m_heightmap->height = std::max(height >> levels, 1u);
+    m_heightmap->mipmaps = 1;
+
+    size_t size = size_t(m_heightmap->width) * m_heightmap->height;
+
+    m_heightmap->data = new uint8_t[size * sizeof(uint16_t)];
+
+    memcpy(m_heightmap->data, level, size * sizeof(uint16_t));
+}
+
+void TerrainData::buildHeightMips()
 {
     uint32_t width = m_heightmap->width;
     uint32_t height = m_heightmap->height;
 
-    m_normals = std::make_unique<Image>();
-    m_normals->format = VK_FORMAT_R8G8B8A8_UNORM;
-    m_normals->width = width;
-    m_normals->height = height;
-    m_normals->mipmaps = 1;
-    size_t size = width * height * sizeof(uint32_t);
+    m_heightmap->mipmaps = uint32_t(log2f(std::max(width, height))) + 1;
+
+    std::vector<uint16_t> heights(mipChainTexels(width, height, m_heightmap->mipmaps));
+    memcpy(heights.data(), m_heightmap->data, size_t(width) * height * sizeof(uint16_t));
+
+    buildMipChain(heights.data(), width, height, m_heightmap->mipmaps, averageHeights);
+
+    // CPU copy of first level stays for tile ranges and heightmap pages
+    TextureData texture;
+    texture.data.resize(heights.size() * sizeof(uint16_t));
+    memcpy(texture.data.data(), heights.data(), texture.data.size());
+    texture.regions = LevelRegions(*m_heightmap, m_heightmap->mipmaps);
+
+    m_uploads.push_back({ m_heightmap.get(), std::move(texture) });
+}
+
+// Normal codecs, stored vector is (-dh/dx, dh/dy, 1) normalized
+static uint32_t encodeRGBA8(const glm::vec3& n)
+{
+    glm::uvec3 c = glm::uvec3((n * 0.5f + 0.5f) * 255.0f);
+    return c.r | c.g << 8 | c.b << 16;
+}
+
+static glm::vec3 decodeRGBA8(uint32_t c)
+{
+    return glm::vec3(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff) / 255.0f * 2.0f - 1.0f;
+}
+
+// Octahedral projection, lower hemisphere is folded over the diagonals
+static glm::vec2 octEncode(const glm::vec3& n)
+{
+    glm::vec3 p = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+
+    if (p.z >= 0.0f) return { p.x, p.y };
 
-    Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
-    uint32_t* normals = reinterpret_cast<uint32_t*>(buffer.map(size));
+    return { (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+             (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f) };
+}
 
-    auto heightmap = [data = reinterpret_cast<uint16_t*>(m_heightmap->data), width, scale = m_height * m_scale](size_t x, size_t y) -> float
+static glm::vec3 octDecode(const glm::vec2& e)
+{
+    glm::vec3 n = { e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y) };
+
+    if (n.z < 0.0f)
     {
-        uint16_t val = *(data + (y * width + x));
-        return val / 65535.0f * scale;
-    };
+        n.x = (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return glm::normalize(n);
+}
 
-    auto normal = [normals, width](size_t x, size_t y) -> uint32_t&
+static uint16_t encodeOctRG8(const glm::vec3& n)
+{
+    glm::ivec2 q = glm::ivec2(glm::round(octEncode(n) * 127.0f));
+    return uint16_t(uint8_t(q.x) | uint8_t(q.y) << 8);
+}
+
+static glm::vec3 decodeOctRG8(uint16_t c)
+{
+    return octDecode(glm::max(glm::vec2(int8_t(c & 0xff), int8_t(c >> 8)) / 127.0f, -1.0f));
+}
+
+static uint32_t encodeOctRG16(const glm::vec3& n)
+{
+    glm::ivec2 q = glm::ivec2(glm::round(octEncode(n) * 32767.0f));
+    return uint32_t(uint16_t(q.x)) | uint32_t(uint16_t(q.y)) << 16;
+}
+
+static glm::vec3 decodeOctRG16(uint32_t c)
+{
+    return octDecode(glm::max(glm::vec2(int16_t(c & 0xffff), int16_t(c >> 16)) / 32767.0f, -1.0f));
+}
+
+VkFormat NormalTextureFormat(NormalFormat format)
+{
+    switch (format)
+    {
+    case NormalFormat::RGBA8: return VK_FORMAT_R8G8B8A8_UNORM;
+    case NormalFormat::OctRG8: return VK_FORMAT_R8G8_SNORM;
+    case NormalFormat::OctRG16: return VK_FORMAT_R16G16_SNORM;
+    default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+template<class T>
+static void storeNormal(T (*encode)(const glm::vec3&), const glm::vec3& normal, uint8_t* texel)
+{
+    T c = encode(normal);
+    memcpy(texel, &c, sizeof(T));
+}
+
+void EncodeNormal(NormalFormat format, const glm::vec3& normal, uint8_t* texel)
+{
+    switch (format)
     {
-        return *(normals + (y * width + x));
+    case NormalFormat::RGBA8: storeNormal(encodeRGBA8, normal, texel); break;
+    case NormalFormat::OctRG8: storeNormal(encodeOctRG8, normal, texel); break;
+    case NormalFormat::OctRG16: storeNormal(encodeOctRG16, normal, texel); break;
+    case NormalFormat::Derived: break;
+    }
+}
+
+template<class T>
+static std::unique_ptr<Image> createNormalMap(const Image& heightmap, float scale, VkFormat format, T (*encode)(const glm::vec3&), glm::vec3 (*decode)(T), TextureData& texture)
+{
+    uint32_t width = heightmap.width;
+    uint32_t height = heightmap.height;
+
+    std::unique_ptr<Image> image = std::make_unique<Image>();
+    image->format = format;
+    image->width = width;
+    image->height = height;
+    image->mipmaps = uint32_t(log2f(std::max(width, height))) + 1;
+
+    std::vector<T> normalData(mipChainTexels(width, height, image->mipmaps));
+    T* normals = normalData.data();
+
+    auto heights = [data = reinterpret_cast<const uint16_t*>(heightmap.data), width, scale](size_t x, size_t y) -> float
+    {
+        uint16_t val = *(data + (y * width + x));
+        return val / 65535.0f * scale;
     };
 
-    for (size_t k = 0; k < height; k++)
+    ParallelFor(0, height, [&](uint32_t k)
     {
         for (size_t i = 0; i < width; i++)
         {
-            float p = heightmap(i, k);
-            float px = (i + 1) == width ? heightmap(i - 1, k) : heightmap(i + 1, k);
-            float py = (k + 1) == height ? heightmap(i, k - 1) : heightmap(i, k + 1);
+            float p = heights(i, k);
+            float px = (i + 1) == width ? heights(i - 1, k) : heights(i + 1, k);
+            float py = (k + 1) == height ? heights(i, k - 1) : heights(i, k + 1);
 
             float dx = (i + 1) == width ? p - px : px - p;  // 1, 0, dx
             float dy = (k + 1) == height ? p - py : py - p; // 0, 1, dy
 
-            float x = -dx;
-            float y = dy;
-            float z = 1.0f;
+            normals[k * width + i] = encode(glm::normalize(glm::vec3(-dx, dy, 1.0f)));
+        }
+    });
 
-            float len = sqrt(x * x + y * y + z * z);
+    // Averaged normals are renormalized, coarse levels keep unit length for lighting
+    buildMipChain(normals, width, height, image->mipmaps, [decode, encode](const T* in, uint32_t w, uint32_t h, uint32_t x, uint32_t y)
+    {
+        glm::vec3 sum(0.0f);
 
-            x /= len;
-            y /= len;
-            z /= len;
+        for (T c : mipFootprint(in, w, h, x, y)) sum += decode(c);
 
-            uint32_t r = (x * 0.5f + 0.5f) * 255.0f;
-            uint32_t g = (y * 0.5f + 0.5f) * 255.0f;
-            uint32_t b = (z * 0.5f + 0.5f) * 255.0f;
+        return encode(glm::length(sum) > 0.0f ? glm::normalize(sum) : glm::vec3(0.0f, 0.0f, 1.0f));
+    });
 
-            uint32_t color = r | g << 8 | b << 16;
+    texture.data.resize(normalData.size() * sizeof(T));
+    memcpy(texture.data.data(), normalData.data(), texture.data.size());
+    texture.regions = LevelRegions(*image, image->mipmaps);
 
-            normal(i, k) = color;
-        }
+    return image;
+}
+
+void TerrainData::buildNormals()
+{
+    float scale = m_height * m_scale;
+
+    TextureData texture;
+
+    switch (m_normalFormat)
+    {
+    case NormalFormat::RGBA8:
+        m_normals = createNormalMap(*m_heightmap, scale, VK_FORMAT_R8G8B8A8_UNORM, encodeRGBA8, decodeRGBA8, texture);
+        break;
+    case NormalFormat::OctRG8:
+        m_normals = createNormalMap(*m_heightmap, scale, VK_FORMAT_R8G8_SNORM, encodeOctRG8, decodeOctRG8, texture);
+        break;
+    case NormalFormat::OctRG16:
+        m_normals = createNormalMap(*m_heightmap, scale, VK_FORMAT_R16G16_SNORM, encodeOctRG16, decodeOctRG16, texture);
+        break;
+    case NormalFormat::Derived:
+        m_normals.reset();
+        break;
     }
 
-    buffer.unmap();
+    if (m_normals) m_uploads.push_back({ m_normals.get(), std::move(texture) });
+}
 
-    Render::VulkanInstance::GetInstance().createTexture(buffer, *m_normals);
+size_t TerrainData::normalBytes() const
+{
+    if (!m_normals || !m_texturesResident) return 0;
+
+    return mipChainTexels(m_normals->width, m_normals->height, m_normals->mipmaps) * pixelsize(m_normals->format);
 }
 
 void TerrainData::buildLayers()
@@ -162,8 +385,9 @@ void TerrainData::buildLayers()
     m_layermap->mipmaps = 1;
     size_t size = width * height * sizeof(uint8_t);
 
-    Render::Buffer buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
-    uint8_t* layers = reinterpret_cast<uint8_t*>(buffer.map(size));
+    TextureData texture;
+    texture.data.resize(size);
+    uint8_t* layers = texture.data.data();
 
     auto heightmap = [data = reinterpret_cast<uint16_t*>(m_heightmap->data), width, scale = m_height](size_t x, size_t y) -> float
     {
@@ -191,24 +415,259 @@ void TerrainData::buildLayers()
         }
     }
 
-    buffer.unmap();
-
-    Render::VulkanInstance::GetInstance().createTexture(buffer, *m_layermap);
+    texture.regions = LevelRegions(*m_layermap, 1);
+    m_uploads.push_back({ m_layermap.get(), std::move(texture) });
 }
 
-void TerrainData::load(const char* filename, float scale)
+bool TerrainData::load(const char* filename, float scale, NormalFormat normalFormat, uint32_t maxSize,
+                       std::unique_ptr<Image>& decoded, const std::atomic<bool>* cancel)
 {
-    m_heightmap.reset(LoadPNG(filename, false, true));
+    auto cancelled = [cancel] { return cancel && *cancel; };
+
+    m_heightmap = std::make_unique<Image>();
+
+    TextureData heights;
+    uint32_t skipped = 0;
+    uint64_t cookedHash = 0;
+
+    {
+        StartupPhase phase("heightmap load");
+
+        // Cooked heightmap carries its mip chain, source is decoded and filtered here otherwise
+        std::string cooked = CookedPath(filename);
+        TexHeader header;
+
+        if (ReadTexHeader(cooked.c_str(), header))
+        {
+            while (maxSize && (header.width >> skipped) > maxSize && skipped + 1 < header.mipmaps) skipped++;
+
+            ReadTEX(cooked.c_str(), *m_heightmap, heights, skipped);
+            cookedHash = header.sourceHash;
+
+            size_t size = levelsize(m_heightmap->format, m_heightmap->width, m_heightmap->height);
+
+            m_heightmap->data = new uint8_t[size];
+            memcpy(m_heightmap->data, heights.data.data(), size);
+        }
+        else
+        {
+            if (!decoded)
+            {
+                auto image = std::make_unique<Image>();
+                if (!DecodePNG(filename, *image)) throw std::runtime_error(std::string("TerrainData: can't load ") + filename);
+
+                decoded = std::move(image);
+            }
+
+            while (maxSize && (decoded->width >> skipped) > maxSize) skipped++;
+
+            // Full resolution load takes decoded source, size limited loads leave it for later ones
+            if (maxSize == 0)
+                m_heightmap = std::move(decoded);
+            else
+                downsampleHeights(*decoded, skipped);
+        }
+    }
+
+    if (cancelled()) return false;
+
+    init(scale, skipped);
+    m_normalFormat = normalFormat;
+
+    StartupPhase phase("terrain preprocessing");
+
+    bool cooked = !heights.data.empty();
 
+    if (!cooked)
+        buildHeightMips();
+    else
+        m_uploads.push_back({ m_heightmap.get(), std::move(heights) });
+
+    if (cancelled()) return false;
+
+    // Derived containers are cooked from full resolution heights, coarse copy builds its own
+    if (!cooked || skipped > 0 || !readCooked(filename, cookedHash))
+    {
+        buildNormals();
+        if (cancelled()) return false;
+
+        buildLayers();
+        if (cancelled()) return false;
+
+        generateTiles();
+    }
+
+    return true;
+}
+
+void TerrainData::init(float scale, uint32_t skipped)
+{
     assert(m_heightmap->width == m_heightmap->height);
 
     m_size = m_heightmap->width;
-    m_levels = uint32_t(log2f(m_size)) - log2f(TileParams::GridSize);
-    m_scale = scale;
+    m_levels = uint32_t(log2f(m_size)) - log2f(TileParams<>::GridSize);
+    m_scale = scale / float(1 << skipped);
+}
+
+// Cooked containers derived from heightmap: cooked/<path without extension>.<name>.tex
+static std::string derivedPath(const char* filename, const char* name)
+{
+    std::string path = CookedPath(filename);
+    return path.insert(path.size() - std::strlen(".tex"), std::string(".") + name);
+}
+
+// Derived containers belong to heightmap container they were cooked from and to slope scale of normals
+static uint64_t derivedHash(uint64_t hash, float slopeScale)
+{
+    uint32_t bits;
+    memcpy(&bits, &slopeScale, sizeof(bits));
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        hash ^= (bits >> (i * 8)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Containers of stored normal formats, indexed by NormalFormat
+struct NormalContainer
+{
+    const char* name;
+    VkFormat format;
+};
+
+static const NormalContainer NormalContainers[] = { { "normals-rgba8", VK_FORMAT_R8G8B8A8_UNORM },
+                                                    { "normals-oct8", VK_FORMAT_R8G8_SNORM },
+                                                    { "normals-oct16", VK_FORMAT_R16G16_SNORM } };
+
+// Tile table is a mip chain from leaf level to root, texel holds min height, max height and roughness
+constexpr VkFormat TileTableFormat = VK_FORMAT_R32G32B32_SFLOAT;
+
+// Levels of prepared texture as written to container
+static std::vector<TexLevelData> containerLevels(const Image& image, const TextureData& texture)
+{
+    std::vector<TexLevelData> levels;
+
+    for (const VkBufferImageCopy& region : texture.regions)
+    {
+        uint32_t width = region.imageExtent.width;
+        uint32_t height = region.imageExtent.height;
+        const uint8_t* data = texture.data.data() + region.bufferOffset;
+
+        levels.push_back({ width, height, std::vector<uint8_t>(data, data + levelsize(image.format, width, height)) });
+    }
+
+    return levels;
+}
+
+bool TerrainData::readCooked(const char* filename, uint64_t hash)
+{
+    hash = derivedHash(hash, slopeScale());
+
+    auto read = [filename, hash](const char* name, Image& image, TextureData& texture)
+    {
+        std::string path = derivedPath(filename, name);
+        TexHeader header;
+
+        return ReadTexHeader(path.c_str(), header) && header.sourceHash == hash && ReadTEX(path.c_str(), image, texture);
+    };
+
+    bool storedNormals = m_normalFormat != NormalFormat::Derived;
+
+    auto normals = std::make_unique<Image>();
+    auto layermap = std::make_unique<Image>();
+    Image tiles;
+
+    TextureData normalTexture;
+    TextureData layerTexture;
+    TextureData tileTexture;
+
+    // Nothing is taken unless every container is present and current
+    if (storedNormals)
+    {
+        const NormalContainer& container = NormalContainers[int(m_normalFormat)];
+        if (!read(container.name, *normals, normalTexture) || normals->format != container.format) return false;
+    }
+
+    if (!read("layers", *layermap, layerTexture)) return false;
+    if (!read("tiles", tiles, tileTexture) || tiles.format != TileTableFormat || tiles.mipmaps != m_levels + 1) return false;
+
+    for (uint32_t level = 0; level <= m_levels; level++)
+    {
+        const float* texels = reinterpret_cast<const float*>(tileTexture.data.data() + tileTexture.regions[m_levels - level].bufferOffset);
+        uint32_t tnum = 1 << level;
+
+        for (uint32_t y = 0; y < tnum; y++)
+            for (uint32_t x = 0; x < tnum; x++, texels += 3)
+            {
+                m_ranges[{ level, x, y }] = { texels[0], texels[1] };
+                m_roughness[{ level, x, y }] = texels[2];
+            }
+    }
+
+    if (storedNormals)
+    {
+        m_normals = std::move(normals);
+        m_uploads.push_back({ m_normals.get(), std::move(normalTexture) });
+    }
+
+    m_layermap = std::move(layermap);
+    m_uploads.push_back({ m_layermap.get(), std::move(layerTexture) });
+
+    return true;
+}
+
+void TerrainData::cook(const char* filename, std::unique_ptr<Image> heightmap, float scale, uint64_t hash)
+{
+    m_heightmap = std::move(heightmap);
+
+    init(scale, 0);
+
+    hash = derivedHash(hash, slopeScale());
+
+    for (NormalFormat format : { NormalFormat::RGBA8, NormalFormat::OctRG8, NormalFormat::OctRG16 })
+    {
+        m_normalFormat = format;
+        buildNormals();
+
+        WriteTEX(derivedPath(filename, NormalContainers[int(format)].name).c_str(), m_normals->format, hash, containerLevels(*m_normals, m_uploads.back().second));
+        m_uploads.clear();
+    }
 
-    buildNormals();
     buildLayers();
+
+    WriteTEX(derivedPath(filename, "layers").c_str(), m_layermap->format, hash, containerLevels(*m_layermap, m_uploads.back().second));
+    m_uploads.clear();
+
     generateTiles();
+
+    std::vector<TexLevelData> tiles;
+
+    for (uint32_t level = m_levels; ; level--)
+    {
+        uint32_t tnum = 1 << level;
+
+        TexLevelData table = { tnum, tnum, std::vector<uint8_t>(size_t(tnum) * tnum * 3 * sizeof(float)) };
+        float* texels = reinterpret_cast<float*>(table.data.data());
+
+        for (uint32_t y = 0; y < tnum; y++)
+            for (uint32_t x = 0; x < tnum; x++)
+            {
+                const HeightRange& range = m_ranges.at({ level, x, y });
+
+                *texels++ = range.first;
+                *texels++ = range.second;
+                *texels++ = m_roughness.at({ level, x, y });
+            }
+
+        tiles.push_back(std::move(table));
+
+        if (level == 0) break;
+    }
+
+    WriteTEX(derivedPath(filename, "tiles").c_str(), TileTableFormat, hash, tiles);
 }
 
 void TerrainData::generateTile(uint32_t level, uint32_t x, uint32_t y)
@@ -219,24 +678,56 @@ void TerrainData::generateTile(uint32_t level, uint32_t x, uint32_t y)
               -std::numeric_limits<float>::infinity() };
 
     const uint32_t step = 1 << (m_levels - level);
+    const uint16_t* data = reinterpret_cast<uint16_t*>(m_heightmap->data);
 
-    for (uint32_t k = 0; k <= TileParams::GridSize; k++)
-        for (uint32_t i = 0; i <= TileParams::GridSize; i++)
+    for (uint32_t k = 0; k <= TileParams<>::GridSize; k++)
+        for (uint32_t i = 0; i <= TileParams<>::GridSize; i++)
         {
-            uint32_t l = (x * TileParams::GridSize + i) * step;
-            uint32_t m = (y * TileParams::GridSize + k) * step;
+            uint32_t l = (x * TileParams<>::GridSize + i) * step;
+            uint32_t m = (y * TileParams<>::GridSize + k) * step;
 
             if (l >= m_size) continue;
             if (m >= m_size) continue;
 
             uint32_t data_idx = m * m_size + l;
 
-            uint16_t* data = reinterpret_cast<uint16_t*>(m_heightmap->data);
             float val = data[data_idx] / 65535.0f * m_height;
 
             if (val < range.first) range.first = val;
             if (val > range.second) range.second = val;
         }
+
+    // Linear interpolation error between grid vertices is about an eighth of the discrete Laplacian
+    auto sample = [&](int32_t i, int32_t k) -> float
+    {
+        int32_t l = std::clamp(int32_t(x * TileParams<>::GridSize) + i, 0, int32_t(m_size / step) - 1) * step;
+        int32_t m = std::clamp(int32_t(y * TileParams<>::GridSize) + k, 0, int32_t(m_size / step) - 1) * step;
+
+        return data[m * m_size + l] / 65535.0f * m_height;
+    };
+
+    float laplacian = 0.0f;
+
+    for (int32_t k = 0; k <= int32_t(TileParams<>::GridSize); k++)
+        for (int32_t i = 0; i <= int32_t(TileParams<>::GridSize); i++)
+        {
+            float d = sample(i - 1, k) + sample(i + 1, k) + sample(i, k - 1) + sample(i, k + 1) - 4.0f * sample(i, k);
+            laplacian += d * d;
+        }
+
+    m_roughness[{level, x, y}] = sqrtf(laplacian / TileParams<>::VertexNum) * 0.125f;
+
+    if (level == m_levels) return;
+
+    // Include children so that ranges are conservative for the whole subtree
+    for (uint32_t k = 0; k < 2; k++)
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            const HeightRange& child = m_ranges.at({ level + 1, x * 2 + i, y * 2 + k });
+
+            range.first = std::min(range.first, child.first);
+            range.second = std::max(range.second, child.second);
+        }
 }
 
 void TerrainData::generateLevelTiles(uint32_t level)
@@ -259,6 +750,18 @@ void TerrainData::generateTiles()
     }
 }
 
+void TerrainData::uploadTextures()
+{
+    std::vector<std::pair<Image*, const TextureData*>> textures;
+
+    for (const auto& [image, texture] : m_uploads) textures.push_back({ image, &texture });
+
+    UploadTextures(textures);
+
+    m_uploads.clear();
+    m_texturesResident = true;
+}
+
 const HeightRange& TerrainData::getTileRange(const TileKey& tilekey) const
 {
     return m_ranges.at(tilekey);
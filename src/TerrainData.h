@@ -7,17 +7,27 @@
 #include <map>
 #include <utility>
 #include <memory>
+#include <atomic>
+#include <iterator>
 
+template<size_t Grid = 16>
 struct TileParams
 {
     TileParams() = delete;
     ~TileParams() = delete;
 
-    static constexpr size_t GridSize = 16;
+    static_assert((Grid & (Grid - 1)) == 0, "Tile grid size must be power of two");
+    static_assert((Grid + 1) * (Grid + 1) <= 65536, "Tile vertices must fit 16 bit indices");
+
+    static constexpr size_t GridSize = Grid;
     static constexpr size_t VertexNum = (GridSize + 1) * (GridSize + 1);
     static constexpr size_t IndexNum = GridSize * GridSize * 6;
 };
 
+// Tile mesh resolutions, default grid is used for height ranges and LOD distances
+constexpr size_t TileGridSizes[] = { 4, 8, 16, 32, 64 };
+constexpr size_t TileGridNum = std::size(TileGridSizes);
+
 struct TileKey
 {
     uint32_t level;
@@ -34,23 +44,74 @@ struct TileKey
 
 using HeightRange = std::pair<float, float>;
 
+// Heightmap texels per world unit of terrain, terrain-cook derives normals with the same scale
+constexpr float HeightmapScale = 2.0f;
+
+// Storage of geometry normals, chosen at startup, values match normalFormat in terrain.frag
+enum class NormalFormat
+{
+    RGBA8,      // xyz in unorm channels, alpha unused
+    OctRG8,     // Octahedral encoding in 8 bit snorm channels
+    OctRG16,    // Octahedral encoding in 16 bit snorm channels
+    Derived     // No texture, fragment shader takes heightmap gradient
+};
+
+// Texture format of stored normals, VK_FORMAT_UNDEFINED when derived
+VkFormat NormalTextureFormat(NormalFormat format);
+
+// Writes unit normal to texel of NormalTextureFormat(format), used by heightmap pages of CDLOD
+void EncodeNormal(NormalFormat format, const glm::vec3& normal, uint8_t* texel);
+
 class TerrainData
 {
 public:
     void generateData(uint32_t size, float scale);
 
-    void load(const char* filename, float scale);
+    // CPU side only, safe on worker thread. Heightmap levels larger than maxSize are skipped,
+    // horizontal scale (texels per world unit) follows so world size stays the same.
+    // Full resolution load of cooked heightmap takes cooked normals, layers and tile tables when present.
+    // PNG source is decoded into decoded unless it holds the image already, full resolution load takes
+    // it, size limited loads leave it for later ones. Returns false if cancel was set between stages.
+    bool load(const char* filename, float scale, NormalFormat normalFormat, uint32_t maxSize,
+              std::unique_ptr<Image>& decoded, const std::atomic<bool>* cancel = nullptr);
+
+    // Writes containers derived from heightmap next to its cooked container: normal map of every stored
+    // format, layer map and tile ranges with roughness. Hash is the one of heightmap container.
+    void cook(const char* filename, std::unique_ptr<Image> heightmap, float scale, uint64_t hash);
+
+    // Creates GPU textures of loaded data in one submit, main thread only. Full resolution heightmap
+    // mip chain and normal map are read by tessellation and clipmap paths only, CDLOD reads heights
+    // through pages, so textures stay CPU side until one of those paths is first selected.
+    void uploadTextures();
+    bool texturesResident() const { return m_texturesResident; }
 
     float height() const { return m_height; }
     uint32_t size() const { return m_size; }
     uint32_t levels() const { return m_levels; }
+    float worldSize() const { return m_size / m_scale; }
 
     const HeightRange& getTileRange(const TileKey& tilekey) const;
 
+    // Estimated interpolation error of default tile grid, in height units
+    float getTileRoughness(const TileKey& tilekey) const { return m_roughness.at(tilekey); }
+
     const Image& heightmap() const { return *m_heightmap; }
-    const Image& normals() const { return *m_normals; }
+    // Heightmap stands in for normal texture when normals are derived in shader
+    const Image& normals() const { return m_normals ? *m_normals : *m_heightmap; }
+
+    NormalFormat normalFormat() const { return m_normalFormat; }
+    // GPU memory of normal texture, zero until textures are uploaded
+    size_t normalBytes() const;
+
+    // Normal slope per height difference of neighbour texels, heights in 0..1
+    float slopeScale() const { return m_height * m_scale; }
 
 private:
+    void init(float scale, uint32_t skipped);
+    bool readCooked(const char* filename, uint64_t hash);
+
+    void downsampleHeights(const Image& source, uint32_t levels);
+    void buildHeightMips();
     void buildNormals();
     void buildLayers();
 
@@ -61,15 +122,22 @@ private:
 private:
     uint32_t m_size;
     uint32_t m_levels;
-    uint32_t m_scale;
-    
+    float m_scale;
+
     std::vector<float> m_data;
 
     float m_height = 150.0f;
 
+    NormalFormat m_normalFormat = NormalFormat::RGBA8;
+
     std::unique_ptr<Image> m_heightmap;
     std::unique_ptr<Image> m_normals;
     std::unique_ptr<Image> m_layermap;
 
+    // Level data of images above waiting for upload
+    std::vector<std::pair<Image*, TextureData>> m_uploads;
+    bool m_texturesResident = false;
+
     std::map<TileKey, HeightRange> m_ranges;
+    std::map<TileKey, float> m_roughness;
 };
\ No newline at end of file
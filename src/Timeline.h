@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+// Wall clock phases of application startup. Intervals of one phase merge into its span and busy time,
+// phases recorded on worker threads overlap the ones of main thread.
+class StartupTimeline
+{
+    struct Phase
+    {
+        const char* name;
+        double begin;
+        double end;
+        double busy;
+        uint32_t count;
+    };
+
+    CpuTimer m_clock;
+    std::mutex m_lock;
+    std::vector<Phase> m_phases;
+
+public:
+    static StartupTimeline& GetInstance()
+    {
+        static StartupTimeline timeline;
+        return timeline;
+    }
+
+    // Milliseconds since first use
+    double now() const { return m_clock.elapsed(); }
+
+    void add(const char* name, double begin, double end)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        for (Phase& phase : m_phases)
+        {
+            if (strcmp(phase.name, name) == 0)
+            {
+                phase.begin = std::min(phase.begin, begin);
+                phase.end = std::max(phase.end, end);
+                phase.busy += end - begin;
+                phase.count++;
+                return;
+            }
+        }
+
+        m_phases.push_back({ name, begin, end, end - begin, 1 });
+    }
+
+    void report()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        std::sort(m_phases.begin(), m_phases.end(), [](const Phase& a, const Phase& b) { return a.begin < b.begin; });
+
+        std::cout << "Startup timeline, ms:" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+
+        for (const Phase& phase : m_phases)
+        {
+            std::cout << "  " << std::left << std::setw(24) << phase.name << std::right
+                      << std::setw(8) << phase.begin << " - " << std::setw(8) << phase.end
+                      << "  busy " << std::setw(8) << phase.busy << "  x" << phase.count << std::endl;
+        }
+
+        std::cout << "  " << std::left << std::setw(24) << "total" << std::right << std::setw(8) << now() << std::endl;
+        std::cout << std::defaultfloat;
+    }
+};
+
+// Records its lifetime as one interval of named phase
+class StartupPhase
+{
+    const char* m_name;
+    double m_begin;
+
+public:
+    explicit StartupPhase(const char* name) : m_name(name), m_begin(StartupTimeline::GetInstance().now()) {}
+
+    ~StartupPhase() { StartupTimeline::GetInstance().add(m_name, m_begin, StartupTimeline::GetInstance().now()); }
+};
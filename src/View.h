@@ -3,6 +3,8 @@
 #include "Render/Render.h"
 #include "Terrain.h"
 
+#include <cmath>
+
 struct ViewConstantBuffer
 {
     glm::mat4 viewProj;
@@ -30,15 +32,26 @@ public:
     const auto& skyConstantBuffer() const { return m_skyConstantBuffer; }
     const auto& sceneConstantBuffer() const { return m_sceneConstantBuffer; }
 
+    const glm::mat4& viewProj() const { return m_sceneConstantBuffer->viewProj; }
+
     void update();
     void update(uint32_t width, uint32_t height);
 
     void reflect(const View& view, float h);
 
     void updateVisibility() { m_terrainView.update(); }
+    void setSortTiles(bool sort) { m_terrainView.setSortTiles(sort); }
+
+    void updateWater(float level, float extent) { m_terrainView.updateWater(level, extent); }
+    bool waterVisible() const { return m_terrainView.waterVisible(); }
+    bool underwater() const { return m_terrainView.underwater(); }
+    glm::vec4 waterScreenBounds() const { return m_terrainView.waterScreenBounds(viewProj()); }
+    size_t waterTileCount() const { return m_terrainView.waterTileCount(); }
 
     void displayTerrain(Render::CommandList& commandList) const { m_terrainView.display(commandList); }
+    void displayTerrainPatches(Render::CommandList& commandList, uint32_t height) const { m_terrainView.displayPatches(commandList, std::abs(m_projMat[1][1]) * height * 0.5f); }
     void displayBBoxes(Render::CommandList& commandList) const { m_terrainView.displayBBoxes(commandList); }
+    void displayWater(Render::CommandList& commandList) const { m_terrainView.displayWater(commandList); }
 
 private:
     glm::mat4 m_projMat;
@@ -0,0 +1,391 @@
+#include <glm/glm.hpp>
+
+#include "VirtualHeightmap.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <cstring>
+#include <cassert>
+
+// Staged pages keep buffer offsets 4 byte aligned
+constexpr size_t PageBytes = (VirtualHeightmap::PageStride * VirtualHeightmap::PageStride * sizeof(uint16_t) + 3) & ~size_t(3);
+
+const glm::uvec4 NoDirtyEntries = { UINT32_MAX, UINT32_MAX, 0, 0 };
+
+VirtualHeightmap::VirtualHeightmap(const Image& heightmap, uint32_t mips, NormalFormat normalFormat, float slopeScale)
+: m_heightmap(heightmap)
+, m_normalFormat(normalFormat)
+, m_slopeScale(slopeScale)
+, m_normalBytes(0)
+, m_pinnedMip(mips - 1)
+, m_pageTable(VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+, m_atlas(VK_FORMAT_R16_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+, m_normalAtlas(NormalTextureFormat(normalFormat), VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+, m_slots(AtlasPages * AtlasPages)
+{
+    // Vertex shader derives heightmap size from page table height
+    assert(heightmap.width % PageSize == 0);
+
+    m_levels.resize(mips);
+
+    uint32_t tableWidth = 0;
+    size_t tableSize = 0;
+
+    for (uint32_t mip = 0; mip < mips; mip++)
+    {
+        Level& level = m_levels[mip];
+
+        uint32_t texels = std::max(heightmap.width >> mip, 1u);
+
+        level.pages = (texels + PageSize - 1) / PageSize;
+        level.offset = tableWidth;
+        level.entries.assign(level.pages * level.pages, 0);
+        level.dirty = { 0, 0, level.pages, level.pages };
+
+        tableWidth += level.pages;
+        tableSize += level.entries.size() * sizeof(uint32_t);
+
+        if (level.pages == 1) m_pinnedMip = std::min(m_pinnedMip, mip);
+    }
+
+    m_pageTable.reset(tableWidth, m_levels[0].pages);
+    m_atlas.reset(AtlasPages * PageStride, AtlasPages * PageStride);
+
+    if (normalFormat != NormalFormat::Derived)
+    {
+        m_normalBytes = uint32_t(PageStride * PageStride * pixelsize(NormalTextureFormat(normalFormat)) + 3) & ~3u;
+        m_normalAtlas.reset(AtlasPages * PageStride, AtlasPages * PageStride);
+    }
+
+    // Normals of staged pages follow all heights
+    m_pageStaging.reset(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MaxUploads * (PageBytes + m_normalBytes));
+    m_tableStaging.reset(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tableSize);
+
+    // Coarsest levels are loaded up front and placed by first update
+    for (uint32_t mip = mips; mip-- > m_pinnedMip; )
+    {
+        LoadedPage page = { { mip, 0, 0 } };
+        loadPage(page);
+
+        m_loading.insert(page.key);
+        m_loaded.push_back(std::move(page));
+    }
+
+    m_loader = std::thread(&VirtualHeightmap::loaderThread, this);
+}
+
+VirtualHeightmap::~VirtualHeightmap()
+{
+    m_lock.lock();
+    m_terminate = true;
+    m_lock.unlock();
+
+    m_loaderWake.notify_one();
+    m_loader.join();
+}
+
+size_t VirtualHeightmap::normalAtlasBytes() const
+{
+    if (m_normalBytes == 0) return 0;
+
+    return size_t(AtlasPages * PageStride) * (AtlasPages * PageStride) * pixelsize(NormalTextureFormat(m_normalFormat));
+}
+
+void VirtualHeightmap::loadPage(LoadedPage& page) const
+{
+    const PageKey& key = page.key;
+    const uint16_t* source = reinterpret_cast<const uint16_t*>(m_heightmap.data);
+
+    int32_t maxX = int32_t(m_heightmap.width) - 1;
+    int32_t maxY = int32_t(m_heightmap.height) - 1;
+
+    auto height = [&](int32_t x, int32_t y) { return source[y * m_heightmap.width + x] / 65535.0f; };
+
+    page.data.resize(PageStride * PageStride);
+    page.normals.resize(m_normalBytes);
+
+    size_t texelBytes = m_normalBytes > 0 ? pixelsize(NormalTextureFormat(m_normalFormat)) : 0;
+    int32_t spacing = 1 << key.mip;
+
+    for (uint32_t k = 0; k < PageStride; k++)
+        for (uint32_t i = 0; i < PageStride; i++)
+        {
+            int32_t sx = std::min(int32_t(key.x * PageSize + i) << key.mip, maxX);
+            int32_t sy = std::min(int32_t(key.y * PageSize + k) << key.mip, maxY);
+
+            page.data[k * PageStride + i] = source[sy * m_heightmap.width + sx];
+
+            if (texelBytes == 0) continue;
+
+            // Central differences across mip spacing equal mean slope of finer texels in between,
+            // stored vector is (-dh/dx, dh/dy, 1) normalized like TerrainData normal maps
+            int32_t x0 = std::max(sx - spacing, 0);
+            int32_t x1 = std::min(sx + spacing, maxX);
+            int32_t y0 = std::max(sy - spacing, 0);
+            int32_t y1 = std::min(sy + spacing, maxY);
+
+            float dx = (height(x1, sy) - height(x0, sy)) * m_slopeScale / float(x1 - x0);
+            float dy = (height(sx, y1) - height(sx, y0)) * m_slopeScale / float(y1 - y0);
+
+            EncodeNormal(m_normalFormat, glm::normalize(glm::vec3(-dx, dy, 1.0f)), page.normals.data() + (k * PageStride + i) * texelBytes);
+        }
+}
+
+void VirtualHeightmap::loaderThread()
+{
+    std::unique_lock<SpinLock> lock(m_lock);
+
+    while (true)
+    {
+        m_loaderWake.wait(lock, [this] { return m_terminate || !m_requests.empty(); });
+
+        if (m_terminate) break;
+
+        PageKey key = m_requests.front();
+        m_requests.pop_front();
+        m_loading.insert(key);
+
+        lock.unlock();
+
+        LoadedPage page = { key };
+        loadPage(page);
+
+        lock.lock();
+
+        m_loaded.push_back(std::move(page));
+    }
+}
+
+void VirtualHeightmap::request(const PageKey& key)
+{
+    m_lock.lock();
+
+    auto it = m_resident.find(key);
+
+    if (it != m_resident.end())
+        m_slots[it->second].lastUsed = m_frame;
+    else
+        m_wanted.insert(key);
+
+    m_lock.unlock();
+}
+
+uint32_t VirtualHeightmap::allocateSlot()
+{
+    uint32_t lru = UINT32_MAX;
+
+    for (uint32_t i = 0; i < m_slots.size(); i++)
+    {
+        const Slot& slot = m_slots[i];
+
+        if (!slot.used) return i;
+
+        // Pages used since last update are still drawn
+        if (slot.key.mip >= m_pinnedMip || slot.lastUsed >= m_frame) continue;
+
+        if (lru == UINT32_MAX || slot.lastUsed < m_slots[lru].lastUsed) lru = i;
+    }
+
+    if (lru != UINT32_MAX)
+    {
+        Slot& slot = m_slots[lru];
+
+        m_resident.erase(slot.key);
+        slot.used = false;
+
+        updateEntries(slot.key);
+    }
+
+    return lru;
+}
+
+void VirtualHeightmap::updateEntries(const PageKey& key)
+{
+    Level& level = m_levels[key.mip];
+
+    // Missing page uses entry of its parent, pinned levels terminate the chain
+    uint32_t entry = 0;
+
+    auto it = m_resident.find(key);
+
+    if (it != m_resident.end())
+    {
+        entry = it->second | key.mip << 16;
+    }
+    else if (key.mip + 1 < m_levels.size())
+    {
+        const Level& parent = m_levels[key.mip + 1];
+        entry = parent.entries[(key.y / 2) * parent.pages + key.x / 2];
+    }
+
+    uint32_t& current = level.entries[key.y * level.pages + key.x];
+
+    if (current == entry) return;
+
+    current = entry;
+
+    level.dirty = { std::min(level.dirty.x, key.x), std::min(level.dirty.y, key.y),
+                    std::max(level.dirty.z, key.x + 1), std::max(level.dirty.w, key.y + 1) };
+
+    if (key.mip == 0) return;
+
+    // Children that are not resident inherit the new entry
+    const Level& child = m_levels[key.mip - 1];
+
+    for (uint32_t k = 0; k < 2; k++)
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            PageKey childKey = { key.mip - 1, key.x * 2 + i, key.y * 2 + k };
+
+            if (childKey.x >= child.pages || childKey.y >= child.pages) continue;
+            if (m_resident.find(childKey) == m_resident.end()) updateEntries(childKey);
+        }
+}
+
+void VirtualHeightmap::placePage(const LoadedPage& page, uint32_t slot, uint8_t* staging)
+{
+    VkDeviceSize offset = m_pageCopies.size() * PageBytes;
+    VkDeviceSize normalOffset = MaxUploads * PageBytes + m_pageCopies.size() * m_normalBytes;
+
+    memcpy(staging + offset, page.data.data(), page.data.size() * sizeof(uint16_t));
+
+    VkBufferImageCopy copy = {};
+    copy.bufferOffset = offset;
+    copy.bufferRowLength = 0;
+    copy.bufferImageHeight = 0;
+    copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.imageSubresource.mipLevel = 0;
+    copy.imageSubresource.baseArrayLayer = 0;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageOffset = { int32_t(slot % AtlasPages * PageStride), int32_t(slot / AtlasPages * PageStride), 0 };
+    copy.imageExtent = { PageStride, PageStride, 1 };
+
+    m_pageCopies.push_back(copy);
+
+    if (m_normalBytes > 0)
+    {
+        memcpy(staging + normalOffset, page.normals.data(), page.normals.size());
+
+        copy.bufferOffset = normalOffset;
+        m_normalCopies.push_back(copy);
+    }
+
+    m_slots[slot] = { page.key, m_frame, true };
+    m_resident[page.key] = slot;
+
+    updateEntries(page.key);
+}
+
+bool VirtualHeightmap::update()
+{
+    m_pageCopies.clear();
+    m_normalCopies.clear();
+    m_tableCopies.clear();
+
+    std::lock_guard<SpinLock> lock(m_lock);
+
+    // Loader only gets pages wanted since last update, coarse levels first so that fallbacks refine quickly
+    m_requests.clear();
+
+    for (auto it = m_wanted.rbegin(); it != m_wanted.rend(); ++it)
+    {
+        if (m_loading.find(*it) == m_loading.end() && m_resident.find(*it) == m_resident.end()) m_requests.push_back(*it);
+    }
+
+    m_wanted.clear();
+
+    size_t placed = std::min<size_t>(m_loaded.size(), MaxUploads);
+
+    if (placed > 0)
+    {
+        uint8_t* staging = reinterpret_cast<uint8_t*>(m_pageStaging.map(MaxUploads * (PageBytes + m_normalBytes)));
+
+        for (size_t i = 0; i < placed; i++)
+        {
+            const LoadedPage& page = m_loaded[i];
+
+            m_loading.erase(page.key);
+
+            if (m_resident.find(page.key) != m_resident.end()) continue;
+
+            // Atlas full of pages in use drops the page, it is requested again while still visible
+            uint32_t slot = allocateSlot();
+
+            if (slot != UINT32_MAX) placePage(page, slot, staging);
+        }
+
+        m_pageStaging.unmap();
+
+        m_loaded.erase(m_loaded.begin(), m_loaded.begin() + placed);
+    }
+
+    // Changed page table entries, uploaded as one rectangle per mip
+    uint8_t* data = nullptr;
+    VkDeviceSize offset = 0;
+
+    for (uint32_t mip = 0; mip < m_levels.size(); mip++)
+    {
+        Level& level = m_levels[mip];
+
+        if (level.dirty.x >= level.dirty.z) continue;
+
+        if (!data) data = reinterpret_cast<uint8_t*>(m_tableStaging.map(VK_WHOLE_SIZE));
+
+        uint32_t width = level.dirty.z - level.dirty.x;
+        uint32_t height = level.dirty.w - level.dirty.y;
+
+        for (uint32_t k = 0; k < height; k++)
+        {
+            memcpy(data + offset + k * width * sizeof(uint32_t), &level.entries[(level.dirty.y + k) * level.pages + level.dirty.x], width * sizeof(uint32_t));
+        }
+
+        VkBufferImageCopy copy = {};
+        copy.bufferOffset = offset;
+        copy.bufferRowLength = width;
+        copy.bufferImageHeight = height;
+        copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.imageSubresource.mipLevel = 0;
+        copy.imageSubresource.baseArrayLayer = 0;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset = { int32_t(level.offset + level.dirty.x), int32_t(level.dirty.y), 0 };
+        copy.imageExtent = { width, height, 1 };
+
+        m_tableCopies.push_back(copy);
+
+        offset += width * height * sizeof(uint32_t);
+        level.dirty = NoDirtyEntries;
+    }
+
+    if (data) m_tableStaging.unmap();
+
+    m_frame++;
+
+    if (!m_requests.empty()) m_loaderWake.notify_one();
+
+    return !m_pageCopies.empty() || !m_tableCopies.empty();
+}
+
+void VirtualHeightmap::upload(Render::CommandList& commandList)
+{
+    if (!m_pageCopies.empty())
+    {
+        commandList.barrier(m_atlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        commandList.copyBufferToImage(m_pageStaging, m_atlas, m_pageCopies);
+        commandList.barrier(m_atlas, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    if (!m_normalCopies.empty())
+    {
+        commandList.barrier(m_normalAtlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        commandList.copyBufferToImage(m_pageStaging, m_normalAtlas, m_normalCopies);
+        commandList.barrier(m_normalAtlas, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    if (!m_tableCopies.empty())
+    {
+        commandList.barrier(m_pageTable, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        commandList.copyBufferToImage(m_tableStaging, m_pageTable, m_tableCopies);
+        commandList.barrier(m_pageTable, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
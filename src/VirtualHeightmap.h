@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Render/Render.h"
+#include "Resources/Image.h"
+#include "TerrainData.h"
+#include "Sync.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <thread>
+#include <condition_variable>
+
+// Square block of heightmap at given mip, mip texels are point samples of source so that
+// vertices on mip lattice get exactly the same height from any level
+struct PageKey
+{
+    uint32_t mip;
+    uint32_t x;
+    uint32_t y;
+
+    bool operator<(const PageKey& key) const
+    {
+        if (mip != key.mip) return mip < key.mip;
+        if (x != key.x) return x < key.x;
+        return y < key.y;
+    }
+};
+
+// Virtual heightmap: resident pages live in fixed size atlas, page table holds atlas slot of every
+// page per mip, missing pages point to closest resident ancestor. Pages are produced by loader thread
+// and replaced in least recently used order. Stored normal formats get a second atlas with the same
+// slots, normals of a page are taken from heights of its mip.
+class VirtualHeightmap
+{
+public:
+    VirtualHeightmap(const Image& heightmap, uint32_t mips, NormalFormat normalFormat, float slopeScale);
+    ~VirtualHeightmap();
+
+    // Marks page as used this frame, missing page is handed to loader on next update
+    void request(const PageKey& key);
+
+    // Places pages finished by loader into atlas, returns true if upload is needed
+    bool update();
+    void upload(Render::CommandList& commandList);
+
+    const Render::Bitmap& pageTable() const { return m_pageTable; }
+    const Render::Bitmap& atlas() const { return m_atlas; }
+    // Height atlas stands in when normals are derived in shader
+    const Render::Bitmap& normalAtlas() const { return m_normalBytes > 0 ? m_normalAtlas : m_atlas; }
+    // GPU memory of normal atlas, zero when derived
+    size_t normalAtlasBytes() const;
+
+    // Page table texel of page, mips are packed side by side
+    uint32_t tableEntry(const PageKey& key) const { return (m_levels[key.mip].offset + key.x) | key.y << 16; }
+
+    size_t residentPages() const { return m_resident.size(); }
+    size_t uploadedPages() const { return m_pageCopies.size(); }
+
+    static constexpr uint32_t PageSize = 64;
+    static constexpr uint32_t PageStride = PageSize + 1;   // Last row and column repeat first of next page
+    static constexpr uint32_t AtlasPages = 32;             // Slots per atlas side
+    static constexpr uint32_t MaxUploads = 32;             // Pages placed per update
+
+private:
+    struct Level
+    {
+        uint32_t pages;                 // Pages per side
+        uint32_t offset;                // Column of level in page table
+        std::vector<uint32_t> entries;  // Atlas slot and mip of resident page
+        glm::uvec4 dirty;               // Entries changed since last upload, xy min, xy max exclusive
+    };
+
+    struct Slot
+    {
+        PageKey key;
+        uint32_t lastUsed = 0;
+        bool used = false;
+    };
+
+    struct LoadedPage
+    {
+        PageKey key;
+        std::vector<uint16_t> data;
+        std::vector<uint8_t> normals;
+    };
+
+    void loaderThread();
+    void loadPage(LoadedPage& page) const;
+
+    uint32_t allocateSlot();
+    void placePage(const LoadedPage& page, uint32_t slot, uint8_t* staging);
+    void updateEntries(const PageKey& key);
+
+private:
+    const Image& m_heightmap;
+
+    NormalFormat m_normalFormat;
+    float m_slopeScale;
+    uint32_t m_normalBytes;             // Staged normals of one page, zero when derived
+
+    std::vector<Level> m_levels;
+    uint32_t m_pinnedMip;               // Levels of single page are never evicted, so every lookup has fallback
+
+    Render::Bitmap m_pageTable;
+    Render::Bitmap m_atlas;
+    Render::Bitmap m_normalAtlas;
+
+    Render::Buffer m_pageStaging;
+    Render::Buffer m_tableStaging;
+    std::vector<VkBufferImageCopy> m_pageCopies;
+    std::vector<VkBufferImageCopy> m_normalCopies;
+    std::vector<VkBufferImageCopy> m_tableCopies;
+
+    std::vector<Slot> m_slots;
+    std::map<PageKey, uint32_t> m_resident;
+    uint32_t m_frame = 1;
+
+    // Shared with loader thread
+    SpinLock m_lock;
+    std::condition_variable_any m_loaderWake;
+    std::set<PageKey> m_wanted;         // Missing pages requested since last update
+    std::deque<PageKey> m_requests;     // Loader queue, coarse levels first
+    std::set<PageKey> m_loading;
+    std::vector<LoadedPage> m_loaded;
+    bool m_terminate = false;
+
+    std::thread m_loader;
+};
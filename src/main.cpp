@@ -1,28 +1,54 @@
 ﻿#include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 #include "App.h"
+#include "Timeline.h"
 
 #include <iostream>
+#include <cstring>
 
 namespace
 {
 	constexpr int width = 1280;
 	constexpr int height = 720;
+
+	// --normals rgba8|oct8|oct16|derived
+	NormalFormat parseNormalFormat(int argc, char* args[])
+	{
+		const char* names[] = { "rgba8", "oct8", "oct16", "derived" };
+
+		for (int i = 1; i + 1 < argc; i++)
+		{
+			if (strcmp(args[i], "--normals") != 0) continue;
+
+			for (int n = 0; n < 4; n++)
+				if (strcmp(args[i + 1], names[n]) == 0) return NormalFormat(n);
+
+			std::cout << "Unknown normal format: " << args[i + 1] << std::endl;
+		}
+
+		return NormalFormat::RGBA8;
+	}
 }
 
 int main(int argc, char* args[])
 {
-	// Initialize SDL.
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) return 1;
-
-	SDL_Window* window = SDL_CreateWindow("Terra", width, height, SDL_WINDOW_VULKAN);
+	SDL_Window* window;
 	VkSurfaceKHR surface;
 
-	SDL_SetWindowRelativeMouseMode(window, true);
+	{
+		StartupPhase phase("window and device");
+
+		// Initialize SDL.
+		if (SDL_Init(SDL_INIT_VIDEO) < 0) return 1;
 
-	SDL_Vulkan_CreateSurface(window, Render::VulkanInstance::GetInstance(), NULL, &surface);
+		window = SDL_CreateWindow("Terra", width, height, SDL_WINDOW_VULKAN);
+
+		SDL_SetWindowRelativeMouseMode(window, true);
+
+		SDL_Vulkan_CreateSurface(window, Render::VulkanInstance::GetInstance(), NULL, &surface);
+	}
 
-	App app(surface);
+	App app(surface, parseNormalFormat(argc, args));
 
 	unsigned long curtime = SDL_GetTicks();
 
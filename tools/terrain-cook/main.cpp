@@ -0,0 +1,290 @@
+// terrain-cook: converts source textures and heightmaps to GPU ready containers (Resources/Tex.h)
+//
+// terrain-cook [--force] [files or directories...]
+// terrain-cook --benchmark       times mip chain generation of 4k textures
+//
+// Without arguments cooks textures/ and heightmaps/ of current directory. Output of <path>.png
+// is cooked/<path>.tex, it is skipped when its stored hash matches the source. Square 16 bit heightmaps
+// also get cooked/<path>.<name>.tex containers of TerrainData: normal maps, layer map and tile table.
+
+#include "Resources/Image.h"
+#include "Resources/Tex.h"
+#include "Resources/BlockCompress.h"
+#include "Parallel.h"
+#include "TerrainData.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+
+namespace
+{
+    // Bumped whenever cooked output changes for the same source
+    constexpr uint64_t CookVersion = 3;
+
+    std::mutex g_outputLock;
+
+    void report(const std::string& message)
+    {
+        std::lock_guard<std::mutex> lock(g_outputLock);
+        std::cout << message << std::endl;
+    }
+
+    bool readFile(const std::filesystem::path& path, std::vector<uint8_t>& bytes)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return false;
+
+        bytes.resize(size_t(file.tellg()));
+        file.seekg(0);
+
+        return bool(file.read(reinterpret_cast<char*>(bytes.data()), bytes.size()));
+    }
+
+    // FNV-1a of source bytes and cooker version
+    uint64_t contentHash(const std::vector<uint8_t>& bytes)
+    {
+        uint64_t hash = 14695981039346656037ull;
+
+        auto mix = [&hash](uint8_t byte)
+        {
+            hash ^= byte;
+            hash *= 1099511628211ull;
+        };
+
+        for (uint8_t byte : bytes) mix(byte);
+        for (uint32_t i = 0; i < 8; i++) mix(uint8_t(CookVersion >> (i * 8)));
+
+        return hash;
+    }
+
+    // Normal maps keep xy in BC5, colors go to BC1 unless alpha is used, single channel data stays uncompressed
+    VkFormat cookedFormat(const std::filesystem::path& path, const Image& image)
+    {
+        if (image.format != VK_FORMAT_R8G8B8A8_UNORM) return image.format;
+
+        if (IsNormalMap(path.string().c_str())) return VK_FORMAT_BC5_UNORM_BLOCK;
+
+        const uint8_t* texels = reinterpret_cast<const uint8_t*>(image.data);
+
+        for (size_t i = 0; i < size_t(image.width) * image.height; i++)
+            if (texels[i * 4 + 3] != 255) return VK_FORMAT_BC3_UNORM_BLOCK;
+
+        return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    }
+
+    // Textures get Kaiser filtered levels, colors in linear light. Single channel data keeps exact 2x2 average
+    // of TerrainData::buildHeightMips, so cooked and runtime heightmap levels are identical.
+    std::vector<TexLevelData> buildMipChain(const Image& image, bool normalMap)
+    {
+        uint32_t mipmaps = uint32_t(log2f(std::max(image.width, image.height))) + 1;
+
+        bool texture = image.format == VK_FORMAT_R8G8B8A8_UNORM;
+
+        Image chain;
+        chain.format = image.format;
+        chain.width = image.width;
+        chain.height = image.height;
+        chain.mipmaps = mipmaps;
+
+        std::vector<uint8_t> data(chain.size());
+        memcpy(data.data(), image.data, levelsize(image.format, image.width, image.height));
+
+        BuildMipmaps(data.data(), image.width, image.height, image.format, mipmaps, texture ? MipFilter::Kaiser : MipFilter::Box, texture && !normalMap);
+
+        std::vector<TexLevelData> levels(mipmaps);
+
+        uint32_t width = image.width;
+        uint32_t height = image.height;
+        size_t offset = 0;
+
+        for (TexLevelData& level : levels)
+        {
+            size_t size = levelsize(image.format, width, height);
+
+            level = { width, height, std::vector<uint8_t>(data.begin() + offset, data.begin() + offset + size) };
+
+            offset += size;
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+
+        return levels;
+    }
+
+    enum class CookResult { Cooked, UpToDate, Failed };
+
+    CookResult cook(const std::filesystem::path& source, bool force)
+    {
+        std::filesystem::path output = CookedPath(source.generic_string().c_str());
+
+        std::vector<uint8_t> bytes;
+
+        if (!readFile(source, bytes))
+        {
+            report("Can't read " + source.string());
+            return CookResult::Failed;
+        }
+
+        uint64_t hash = contentHash(bytes);
+
+        TexHeader existing;
+
+        if (!force && ReadTexHeader(output.string().c_str(), existing) && existing.sourceHash == hash) return CookResult::UpToDate;
+
+        std::unique_ptr<Image> image(DecodePNG(source.string().c_str()));
+
+        if (!image)
+        {
+            report("Can't decode " + source.string());
+            return CookResult::Failed;
+        }
+
+        VkFormat format = cookedFormat(source, *image);
+        std::vector<TexLevelData> levels = buildMipChain(*image, IsNormalMap(source.string().c_str()));
+
+        if (blockdim(format) > 1)
+        {
+            for (TexLevelData& level : levels) level.data = CompressLevel(level.data.data(), level.width, level.height, format);
+        }
+
+        std::filesystem::create_directories(output.parent_path());
+        WriteTEX(output.string().c_str(), format, hash, levels);
+
+        if (image->format == VK_FORMAT_R16_UNORM && image->width == image->height)
+        {
+            TerrainData terrain;
+            terrain.cook(source.generic_string().c_str(), std::move(image), HeightmapScale, hash);
+        }
+
+        report("Cooked " + source.generic_string() + " -> " + output.generic_string());
+
+        return CookResult::Cooked;
+    }
+
+    // Mip chain of 4k RGBA texture per filter, one texture parallel over rows and several parallel over textures
+    void benchmarkMipmaps()
+    {
+        constexpr uint32_t Size = 4096;
+        constexpr uint32_t Textures = 4;
+
+        Image image;
+        image.format = VK_FORMAT_R8G8B8A8_UNORM;
+        image.width = Size;
+        image.height = Size;
+        image.mipmaps = uint32_t(log2f(Size)) + 1;
+
+        std::vector<std::vector<uint8_t>> chains(Textures, std::vector<uint8_t>(image.size()));
+
+        std::mt19937 generator(1729);
+
+        for (auto& chain : chains)
+            for (size_t i = 0; i < levelsize(image.format, Size, Size); i++) chain[i] = uint8_t(generator());
+
+        struct Mode
+        {
+            const char* name;
+            MipFilter filter;
+            bool srgb;
+        };
+
+        const Mode modes[] = { { "box", MipFilter::Box, false }, { "box srgb", MipFilter::Box, true }, { "kaiser srgb", MipFilter::Kaiser, true } };
+
+        for (const Mode& mode : modes)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            BuildMipmaps(chains[0].data(), Size, Size, image.format, image.mipmaps, mode.filter, mode.srgb);
+
+            auto single = std::chrono::steady_clock::now();
+
+            ParallelFor(0, Textures, [&](uint32_t i)
+            {
+                BuildMipmaps(chains[i].data(), Size, Size, image.format, image.mipmaps, mode.filter, mode.srgb);
+            });
+
+            auto batch = std::chrono::steady_clock::now();
+
+            std::cout << mode.name << ": " << std::chrono::duration<double, std::milli>(single - start).count() << " ms per texture, "
+                      << Textures << " textures " << std::chrono::duration<double, std::milli>(batch - single).count() << " ms" << std::endl;
+        }
+    }
+
+    void collect(const std::filesystem::path& path, std::vector<std::filesystem::path>& sources)
+    {
+        if (std::filesystem::is_directory(path))
+        {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+                if (entry.is_regular_file() && entry.path().extension() == ".png") sources.push_back(entry.path());
+        }
+        else if (std::filesystem::exists(path))
+        {
+            sources.push_back(path);
+        }
+        else
+        {
+            std::cout << "Can't find " << path.string() << std::endl;
+        }
+    }
+}
+
+int main(int argc, char* args[])
+{
+    bool force = false;
+    bool paths = false;
+    std::vector<std::filesystem::path> sources;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(args[i], "--force") == 0) force = true;
+        else if (strcmp(args[i], "--benchmark") == 0)
+        {
+            benchmarkMipmaps();
+            return 0;
+        }
+        else
+        {
+            collect(args[i], sources);
+            paths = true;
+        }
+    }
+
+    if (!paths)
+    {
+        collect("textures", sources);
+        collect("heightmaps", sources);
+    }
+
+    std::vector<CookResult> results(sources.size());
+
+    ParallelFor(0, uint32_t(sources.size()), [&](uint32_t i)
+    {
+        try
+        {
+            results[i] = cook(sources[i], force);
+        }
+        catch (const std::exception& e)
+        {
+            report(sources[i].string() + ": " + e.what());
+            results[i] = CookResult::Failed;
+        }
+    });
+
+    size_t cooked = std::count(results.begin(), results.end(), CookResult::Cooked);
+    size_t upToDate = std::count(results.begin(), results.end(), CookResult::UpToDate);
+    size_t failed = std::count(results.begin(), results.end(), CookResult::Failed);
+
+    std::cout << cooked << " cooked, " << upToDate << " up to date, " << failed << " failed" << std::endl;
+
+    return failed ? 1 : 0;
+}